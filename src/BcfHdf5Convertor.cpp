@@ -16,8 +16,13 @@
 #include "H5Support/H5Utilities.h"
 using namespace H5Support;
 
+#include "BoundedQueue.hpp"
+#include "SFSMemberStream.h"
 #include "SFSNodeItem.h"
+#include "SFSProgress.h"
 #include "SFSReader.h"
+#include "SFSUtils.hpp"
+#include "ThreadPool.hpp"
 #include "Base64.hpp"
 #include "StringUtilities.hpp"
 
@@ -28,6 +33,12 @@ using namespace H5Support;
 
 #include <pugixml.hpp>
 
+#include <zlib.h>
+
+#include <algorithm>
+#include <atomic>
+#include <future>
+#include <map>
 #include <memory>
 #include <utility>
 #include <cstring>
@@ -38,6 +49,7 @@ using namespace H5Support;
 #include <filesystem>
 #include <sstream>
 #include <limits>
+#include <span>
 
 #ifdef SIMPL_USE_GHC_FILESYSTEM
 #include <ghc/filesystem.hpp>
@@ -52,11 +64,6 @@ namespace fs = std::filesystem;
 
 using XmlDocumentType = std::shared_ptr<pugi::xml_document>;
 
-#if defined(__GNUC__) && !defined(__APPLE__)
-#define BDL_POS(var) var.__pos
-#else
-#define BDL_POS(var) var
-#endif
 
 namespace
 {
@@ -69,6 +76,32 @@ const std::string k_Header("Header");
 
 const int32_t k_FileVersion = 4;
 
+// With direct I/O the rows written so far are dropped from the page cache after every this many bytes
+const uint64_t k_DropOutputBytes = 256ULL * 1024ULL * 1024ULL;
+
+// The pattern rows that are in flight between reading and writing use at most this much memory, unless a
+// single row is larger than a third of it
+const uint64_t k_MaxPipelineBytes = 512ULL * 1024ULL * 1024ULL;
+// Flipping is bound by memory bandwidth, so a few workers are enough
+const size_t k_MaxFlipThreads = 4;
+// Compressed chunks are stored with H5Dwrite_chunk(), which appeared in HDF5 1.10.3
+#if H5_VERSION_GE(1, 10, 3)
+const bool k_HasDirectChunkWrite = true;
+#else
+const bool k_HasDirectChunkWrite = false;
+#endif
+
+// Returned by writePatternData() when a compressed chunk could not be stored
+const int32_t k_PatternWriteError = -16;
+// Returned by writePatternData() when the patterns dataset could not be created
+const int32_t k_PatternDatasetError = -17;
+
+// The converted rows are written to HDF5 in batches of about this size
+const uint64_t k_WriteBatchBytes = 64ULL * 1024ULL * 1024ULL;
+// Sorted pattern reads merge patterns less than this far apart into one read of at most k_SortedReadBytes
+const uint64_t k_MaxSortedGapBytes = 256ULL * 1024ULL;
+const uint64_t k_SortedReadBytes = 8ULL * 1024ULL * 1024ULL;
+
 /******************************************************************************
  * START TIFF WRITING SECTION
  *****************************************************************************/
@@ -177,24 +210,15 @@ std::pair<int32_t, std::string> WriteGrayScaleImage(const std::string& filepath,
   return {0, "No Error"};
 }
 
-
-class TempDirectory
+// -----------------------------------------------------------------------------
+/**
+ * @brief Parses the XML member behind 'stream' straight from memory
+ */
+pugi::xml_parse_result loadXmlDocument(pugi::xml_document& document, SFSMemberStream& stream)
 {
-public:
-  TempDirectory(const std::string& path)
-  : m_Path({path}){}
-
-  ~TempDirectory()
-  {
-    if(fs::exists(m_Path))
-    {
-      fs::remove_all(m_Path);
-    }
-  }
-private:
-  fs::path m_Path;
-};
-
+  std::vector<uint8_t> contents = stream.readAll();
+  return document.load_buffer(contents.data(), contents.size());
+}
 
 } // namespace
 
@@ -218,8 +242,49 @@ void BcfHdf5Convertor::setFlipPatterns(bool flipPatterns)
   m_FlipPatterns = flipPatterns;
 }
 
+void BcfHdf5Convertor::setUseMemoryMap(bool useMemoryMap)
+{
+  m_UseMemoryMap = useMemoryMap;
+}
+
+void BcfHdf5Convertor::setUseIndexCache(bool useIndexCache)
+{
+  m_UseIndexCache = useIndexCache;
+}
+
+void BcfHdf5Convertor::setSortPatternReads(bool sortPatternReads)
+{
+  m_SortPatternReads = sortPatternReads;
+}
+
+void BcfHdf5Convertor::setUseDirectIO(bool useDirectIO)
+{
+  m_UseDirectIO = useDirectIO;
+}
+
+void BcfHdf5Convertor::setPrefetchWindow(uint64_t prefetchWindow)
+{
+  m_PrefetchWindow = prefetchWindow;
+}
+
+void BcfHdf5Convertor::setPatternChunking(PatternChunking chunking, uint64_t value)
+{
+  m_PatternChunking = chunking;
+  m_PatternChunkValue = value;
+}
+
+void BcfHdf5Convertor::setCompressionLevel(int32_t compressionLevel)
+{
+  m_CompressionLevel = compressionLevel;
+}
+
+void BcfHdf5Convertor::setProgressObserver(SFSProgressObserver* observer)
+{
+  m_ProgressObserver = observer;
+}
+
 // -----------------------------------------------------------------------------
-int32_t writeCameraConfiguration(hid_t semGrpId, hid_t ebsdGrpId, const std::string& cameraConfiguration)
+int32_t writeCameraConfiguration(hid_t semGrpId, hid_t ebsdGrpId, SFSMemberStream& cameraConfiguration)
 {
   std::string errorStr;
   int errorLine = -1;
@@ -227,14 +292,14 @@ int32_t writeCameraConfiguration(hid_t semGrpId, hid_t ebsdGrpId, const std::str
 
   // Reads and validates inputted xml data files
   XmlDocumentType root = std::make_shared<pugi::xml_document>();
-  pugi::xml_parse_result parseResult = root->load_file(cameraConfiguration.c_str());
+  pugi::xml_parse_result parseResult = loadXmlDocument(*root, cameraConfiguration);
   if(!parseResult)
   {
     std::stringstream  out;
     out << "Error on parsing layer data:";
-    out << "File name: " << cameraConfiguration << ", attr value: [" << root->child("node").attribute("attr").value() << "]\n";
+    out << "File name: " << cameraConfiguration.getPath() << ", attr value: [" << root->child("node").attribute("attr").value() << "]\n";
     out << "Error description: " << parseResult.description() << "\n";
-    out << cameraConfiguration << "[" << parseResult.offset << "]\n\n";
+    out << cameraConfiguration.getPath() << "[" << parseResult.offset << "]\n\n";
     std::cout << out.str() << std::endl;
     return -7080;
   }
@@ -264,7 +329,7 @@ int32_t writeCameraConfiguration(hid_t semGrpId, hid_t ebsdGrpId, const std::str
 }
 
 // -----------------------------------------------------------------------------
-int32_t writeAuxIndexingOptions(hid_t semGrpId, hid_t ebsdGrpId, const std::string& calibrationFile)
+int32_t writeAuxIndexingOptions(hid_t semGrpId, hid_t ebsdGrpId, SFSMemberStream& calibrationFile)
 {
   std::string errorStr;
   int errorLine = -1;
@@ -272,14 +337,14 @@ int32_t writeAuxIndexingOptions(hid_t semGrpId, hid_t ebsdGrpId, const std::stri
 
   // Reads and validates inputted xml data files
   XmlDocumentType root = std::make_shared<pugi::xml_document>();
-  pugi::xml_parse_result parseResult = root->load_file(calibrationFile.c_str());
+  pugi::xml_parse_result parseResult = loadXmlDocument(*root, calibrationFile);
   if(!parseResult)
   {
     std::stringstream  out;
     out << "Error on parsing layer data:";
-    out << "File name: " << calibrationFile << ", attr value: [" << root->child("node").attribute("attr").value() << "]\n";
+    out << "File name: " << calibrationFile.getPath() << ", attr value: [" << root->child("node").attribute("attr").value() << "]\n";
     out << "Error description: " << parseResult.description() << "\n";
-    out << calibrationFile << "[" << parseResult.offset << "]\n\n";
+    out << calibrationFile.getPath() << "[" << parseResult.offset << "]\n\n";
     std::cout << out.str() << std::endl;
     return -7080;
   }
@@ -305,7 +370,7 @@ int32_t writeAuxIndexingOptions(hid_t semGrpId, hid_t ebsdGrpId, const std::stri
 }
 
 // -----------------------------------------------------------------------------
-int32_t writeCalibrationData(hid_t semGrpId, hid_t ebsdGrpId, const std::string& calibrationFile, float& pcx, float& pcy)
+int32_t writeCalibrationData(hid_t semGrpId, hid_t ebsdGrpId, SFSMemberStream& calibrationFile, float& pcx, float& pcy)
 {
   std::string errorStr;
   int errorLine = -1;
@@ -313,14 +378,14 @@ int32_t writeCalibrationData(hid_t semGrpId, hid_t ebsdGrpId, const std::string&
 
   // Reads and validates inputted xml data files
   XmlDocumentType root = std::make_shared<pugi::xml_document>();
-  pugi::xml_parse_result parseResult = root->load_file(calibrationFile.c_str());
+  pugi::xml_parse_result parseResult = loadXmlDocument(*root, calibrationFile);
   if(!parseResult)
   {
     std::stringstream  out;
     out << "Error on parsing layer data:";
-    out << "File name: " << calibrationFile << ", attr value: [" << root->child("node").attribute("attr").value() << "]\n";
+    out << "File name: " << calibrationFile.getPath() << ", attr value: [" << root->child("node").attribute("attr").value() << "]\n";
     out << "Error description: " << parseResult.description() << "\n";
-    out << calibrationFile << "[" << parseResult.offset << "]\n\n";
+    out << calibrationFile.getPath() << "[" << parseResult.offset << "]\n\n";
     std::cout << out.str() << std::endl;
     return -7080;
   }
@@ -357,7 +422,7 @@ int32_t writeCalibrationData(hid_t semGrpId, hid_t ebsdGrpId, const std::string&
 }
 
 // -----------------------------------------------------------------------------
-int32_t writeSEMData(hid_t semGrpId, hid_t ebsdGrpId, const std::string& semFile)
+int32_t writeSEMData(hid_t semGrpId, hid_t ebsdGrpId, SFSMemberStream& semFile)
 {
   std::string errorStr;
   int errorLine;
@@ -365,14 +430,14 @@ int32_t writeSEMData(hid_t semGrpId, hid_t ebsdGrpId, const std::string& semFile
 
   // Reads and validates inputted xml data files
   XmlDocumentType root = std::make_shared<pugi::xml_document>();
-  pugi::xml_parse_result parseResult = root->load_file(semFile.c_str());
+  pugi::xml_parse_result parseResult = loadXmlDocument(*root, semFile);
   if(!parseResult)
   {
     std::stringstream  out;
     out << "Error on parsing layer data:";
-    out << "File name: " << semFile << ", attr value: [" << root->child("node").attribute("attr").value() << "]\n";
+    out << "File name: " << semFile.getPath() << ", attr value: [" << root->child("node").attribute("attr").value() << "]\n";
     out << "Error description: " << parseResult.description() << "\n";
-    out << semFile << "[" << parseResult.offset << "]\n\n";
+    out << semFile.getPath() << "[" << parseResult.offset << "]\n\n";
     std::cout << out.str() << std::endl;
     return -7080;
   }
@@ -491,7 +556,7 @@ int32_t writeSEMData(hid_t semGrpId, hid_t ebsdGrpId, const std::string& semFile
 }
 
 // -----------------------------------------------------------------------------
-int32_t writePhaseInformation(hid_t headerGrpId, const std::string& phaseListFile)
+int32_t writePhaseInformation(hid_t headerGrpId, SFSMemberStream& phaseListFile)
 {
 
   hid_t phaseGrpId = H5Utilities::createGroup(headerGrpId, Bruker::Header::Phases);
@@ -502,14 +567,14 @@ int32_t writePhaseInformation(hid_t headerGrpId, const std::string& phaseListFil
 
   // Reads and validates inputted xml data files
   XmlDocumentType root = std::make_shared<pugi::xml_document>();
-  pugi::xml_parse_result parseResult = root->load_file(phaseListFile.c_str());
+  pugi::xml_parse_result parseResult = loadXmlDocument(*root, phaseListFile);
   if(!parseResult)
   {
     std::stringstream  out;
     out << "Error on parsing layer data:";
-    out << "File name: " << phaseListFile << ", attr value: [" << root->child("node").attribute("attr").value() << "]\n";
+    out << "File name: " << phaseListFile.getPath() << ", attr value: [" << root->child("node").attribute("attr").value() << "]\n";
     out << "Error description: " << parseResult.description() << "\n";
-    out << phaseListFile << "[" << parseResult.offset << "]\n\n";
+    out << phaseListFile.getPath() << "[" << parseResult.offset << "]\n\n";
     std::cout << out.str() << std::endl;
     return -7080;
   }
@@ -652,28 +717,24 @@ int32_t writeDataArrayToHdf5(EbsdDataArray<T>* data, hid_t grpId, size_t numElem
 }
 
 // -----------------------------------------------------------------------------
-int32_t analyzeFrameDescriptionFile(const std::string& descFile)
+int32_t analyzeFrameDescriptionFile(SFSMemberStream& descFile)
 {
   std::cout << "************** Frame Description File START ****************************" << std::endl;
-  if(!fs::exists(descFile))
+  if(!descFile.isValid())
   {
-    std::cout << "The FrameDescription File does not exist: '" << descFile << "'" << std::endl;
+    std::cout << "The FrameDescription File does not exist: '" << descFile.getPath() << "'" << std::endl;
     return -10;
   }
 
-  // Open the FrameData File
-  fs::path inputPath(descFile);
-  std::string absolutPath = fs::absolute(inputPath).string();
-  FILE* f = fopen(absolutPath.c_str(), "rb");
-  if(nullptr == f)
+  FrameDescriptionHeader_t descHeader;
+  // uint64_t filePos = 0;
+  descFile.seek(0);
+  size_t nRead = descFile.read(&descHeader, 12);
+  if(nRead != 12)
   {
-    std::cout << "Could not open the FrameData File" << std::endl;
+    std::cout << "Could not read the FrameDescription header" << std::endl;
     return -14;
   }
-
-  FrameDescriptionHeader_t descHeader;
-  // uint64_t filePos = 0;
-  size_t nRead = fread(&descHeader, 12, 1, f);
   std::cout << "Frame Description File:" << std::endl;
   std::cout << "    Width:" << descHeader.width << std::endl;
   std::cout << "    Height:" << descHeader.height << std::endl;
@@ -683,10 +744,8 @@ int32_t analyzeFrameDescriptionFile(const std::string& descFile)
   for(int32_t i = 0; i < descHeader.patternCount; i++)
   {
     uint64_t offset = 0;
-    fpos_t pos;
-    fgetpos(f, &pos);
-    nRead = fread(&offset, sizeof(uint64_t), 1, f);
-    if(offset != 0xFFFFFFFFFFFFFFFF)
+    nRead = descFile.read(&offset, sizeof(uint64_t));
+    if(nRead == sizeof(uint64_t) && offset != 0xFFFFFFFFFFFFFFFF)
     {
       totalPatternsAvailable++;
       if(offset > maxIndex)
@@ -697,18 +756,147 @@ int32_t analyzeFrameDescriptionFile(const std::string& descFile)
   }
   std::cout << "Total Pixels Measured: " << totalPatternsAvailable << std::endl;
   // std::cout << "Max File Index: " << maxIndex << std::endl;
-  fclose(f);
   std::cout << "************** Frame Description File END ****************************" << std::endl;
 
   return 0;
 }
 
 
+// -----------------------------------------------------------------------------
+/**
+ * @brief Returns a view of 'length' bytes starting at 'offset' within the member if all of those bytes live
+ * inside a single chunk of the memory mapped container. An empty span is returned otherwise, including for
+ * compressed members whose stored bytes are not the pattern data.
+ */
+std::span<const uint8_t> getMemberView(const SFSNodeItem& node, uint64_t offset, uint64_t length, uint64_t usableChunkSize)
+{
+  if(node.isCompressed())
+  {
+    return {};
+  }
+  uint64_t chunkOffset = offset % usableChunkSize;
+  std::span<const uint8_t> chunk = node.getChunkView(offset / usableChunkSize);
+  if(chunkOffset + length > chunk.size())
+  {
+    return {};
+  }
+  return chunk.subspan(chunkOffset, length);
+}
+
+// -----------------------------------------------------------------------------
+/**
+ * @brief Flushes the HDF5 file that holds 'objectId' and drops its pages from the page cache. Only files
+ * written through the default sec2 driver expose a descriptor for that. Other drivers are left alone.
+ */
+void dropHdf5FileCache(hid_t objectId)
+{
+  hid_t fileId = H5Iget_file_id(objectId);
+  if(fileId < 0)
+  {
+    return;
+  }
+  hid_t fapl = H5Fget_access_plist(fileId);
+  void* vfdHandle = nullptr;
+  if(fapl >= 0 && H5Pget_driver(fapl) == H5FD_SEC2 && H5Fflush(fileId, H5F_SCOPE_LOCAL) >= 0 && H5Fget_vfd_handle(fileId, H5P_DEFAULT, &vfdHandle) >= 0 && vfdHandle != nullptr)
+  {
+    SFSUtils::dropCachedRange(*static_cast<int*>(vfdHandle), 0, 0);
+  }
+  if(fapl >= 0)
+  {
+    H5Pclose(fapl);
+  }
+  H5Fclose(fileId);
+}
+
+// -----------------------------------------------------------------------------
+/**
+ * @brief Returns the number of patterns per HDF5 chunk of the patterns dataset for the given strategy
+ */
+hsize_t getChunkPatternCount(BcfHdf5Convertor::PatternChunking chunking, uint64_t value, int32_t mapWidth, int32_t mapHeight, uint64_t patternByteCount)
+{
+  uint64_t patternCount = static_cast<uint64_t>(mapWidth);
+  if(chunking == BcfHdf5Convertor::PatternChunking::Patterns)
+  {
+    patternCount = value;
+  }
+  else if(chunking == BcfHdf5Convertor::PatternChunking::Bytes)
+  {
+    patternCount = (value > 0 ? value : BcfHdf5Convertor::k_DefaultChunkBytes) / std::max<uint64_t>(patternByteCount, 1);
+  }
+  // A chunk can not be larger than the whole dataset or than HDF5 allows
+  const uint64_t maxPatternCount = std::min<uint64_t>(static_cast<uint64_t>(mapWidth) * mapHeight, BcfHdf5Convertor::k_MaxChunkBytes / std::max<uint64_t>(patternByteCount, 1));
+  return static_cast<hsize_t>(std::clamp<uint64_t>(patternCount, 1, std::max<uint64_t>(maxPatternCount, 1)));
+}
+
+// -----------------------------------------------------------------------------
+/**
+ * @brief Sizes the chunk cache so every chunk that a write of 'writePatternCount' patterns touches, including
+ * the ones it shares with the writes before and after it, stays in memory until it is complete. Fully written
+ * chunks are evicted first since they are never read back.
+ */
+void setPatternChunkCache(hid_t dapl, hsize_t chunkPatternCount, size_t writePatternCount, uint64_t patternByteCount)
+{
+  const uint64_t chunkCount = (static_cast<uint64_t>(writePatternCount) + chunkPatternCount - 1) / chunkPatternCount + 1;
+  // The hash table should be about 100 times larger than the number of chunks and a prime
+  size_t slotCount = static_cast<size_t>(chunkCount * 100 + 1);
+  auto isPrime = [](size_t n) {
+    for(size_t d = 3; d * d <= n; d += 2)
+    {
+      if(n % d == 0)
+      {
+        return false;
+      }
+    }
+    return true;
+  };
+  while(!isPrime(slotCount))
+  {
+    slotCount += 2;
+  }
+  H5Pset_chunk_cache(dapl, slotCount, static_cast<size_t>(chunkCount * chunkPatternCount * patternByteCount), 1.0);
+}
+
+// -----------------------------------------------------------------------------
+/**
+ * @brief Runs 'chunk' through the same steps as the HDF5 shuffle and deflate filters, so the result can be
+ * stored with H5Dwrite_chunk() and read back by any HDF5 tool
+ * @return The compressed chunk or an empty vector if zlib failed
+ */
+std::vector<uint8_t> compressPatternChunk(const uint8_t* chunk, size_t byteCount, size_t elementSize, int32_t level)
+{
+  std::vector<uint8_t> shuffled;
+  const uint8_t* source = chunk;
+  if(elementSize > 1)
+  {
+    // Byte b of every element goes into the b'th block of the shuffled chunk
+    shuffled.resize(byteCount);
+    const size_t elementCount = byteCount / elementSize;
+    for(size_t b = 0; b < elementSize; b++)
+    {
+      uint8_t* block = shuffled.data() + b * elementCount;
+      for(size_t i = 0; i < elementCount; i++)
+      {
+        block[i] = chunk[i * elementSize + b];
+      }
+    }
+    source = shuffled.data();
+  }
+  uLongf compressedSize = compressBound(static_cast<uLong>(byteCount));
+  std::vector<uint8_t> compressed(compressedSize);
+  if(compress2(compressed.data(), &compressedSize, source, static_cast<uLong>(byteCount), level) != Z_OK)
+  {
+    compressed.clear();
+    return compressed;
+  }
+  compressed.resize(compressedSize);
+  return compressed;
+}
+
 // -----------------------------------------------------------------------------
 template <typename T>
 int32_t writePatternData(const SFSReader& sfsFile, hid_t native_type, int32_t mapWidth, int32_t mapHeight, int32_t ebspWidth,
-                         int32_t ebspHeight, bool flipPatterns, const std::string& tempDir, const std::string& dataFile,
-                         const std::string& descFile, hid_t dataGrpId)
+                         int32_t ebspHeight, bool flipPatterns, bool sortReads, BcfHdf5Convertor::PatternChunking chunking, uint64_t chunkValue, int32_t compressionLevel, const std::string& dataFile,
+                         SFSMemberStream& descFile, hid_t dataGrpId, SFSProgressObserver* observer)
 {
   int32_t err = 0;
   // ===================================================
@@ -721,9 +909,9 @@ int32_t writePatternData(const SFSReader& sfsFile, hid_t native_type, int32_t ma
 
   // ===================================================
   // Check the FrameDescription File exists
-  if(!fs::exists(descFile))
+  if(!descFile.isValid())
   {
-    std::cout << "The FrameDescription File does not exist: '" << descFile << "'" << std::endl;
+    std::cout << "The FrameDescription File does not exist: '" << descFile.getPath() << "'" << std::endl;
     return -10;
   }
 
@@ -733,203 +921,508 @@ int32_t writePatternData(const SFSReader& sfsFile, hid_t native_type, int32_t ma
     return err;
   }
 
-  // Open the FrameDescription File. This tells for every scan point, where the pattern
+  // Read the FrameDescription File. This tells for every scan point, where the pattern
   // data starts in the FrameData file.
   std::vector<size_t> frameDescription;
   {
-    fs::path inputPath(descFile);
-    std::string absolutPath = fs::absolute(inputPath).string();
-    FILE* f = fopen(absolutPath.c_str(), "rb");
     FrameDescriptionHeader_t descHeader;
-    size_t nRead = fread(&descHeader, 12, 1, f);
-    frameDescription.resize(descHeader.patternCount);
-    nRead = fread(frameDescription.data(), sizeof(size_t), descHeader.patternCount, f);
-    fclose(f);
+    descFile.seek(0);
+    descFile.read(&descHeader, 12);
+    // Every scan point gets an entry. Any entries missing from a short or truncated file are treated as "no pattern".
+    const size_t entryCount = static_cast<size_t>(std::max(descHeader.patternCount, 0));
+    frameDescription.resize(std::max<size_t>(entryCount, static_cast<size_t>(mapWidth) * mapHeight), 0xFFFFFFFFFFFFFFFF);
+    descFile.read(frameDescription.data(), sizeof(size_t) * entryCount);
   }
 
   // ===================================================
-  // Extract the FrameData file from the .bcf file. this can take a bit....
-  err = sfsFile.extractFile(tempDir, dataFile);
-  if(err != 0)
-  {
-    std::cout << "Error extracting the " << dataFile << ". This data set will not be included in the resulting HDF5 file." << std::endl;
-    return err;
-  }
-
-  fs::path filePath = tempDir + "/" + dataFile;
-  if(!fs::exists(filePath))
+  // The patterns are read straight out of the .bcf file. The stream is unbuffered because
+  // every pattern is fetched with a single positional read anyway. Direct reads skip the kernel's
+  // read-ahead and page cache though, so with direct I/O the patterns are always read in stored order,
+  // where neighbouring patterns share one large read and every other pattern gets its own aligned read.
+  const bool directIO = sfsFile.getUseDirectIO();
+  const bool sortedReads = sortReads || directIO;
+  SFSNodeItemPtr frameDataNode = sfsFile.findNode(dataFile);
+  SFSMemberStream frameData(frameDataNode, 0);
+  if(!frameData.isValid())
   {
-    std::cout << "The FrameData File does not exist: '" << filePath << "'" << std::endl;
+    std::cout << "The FrameData File does not exist: '" << dataFile << "'. This data set will not be included in the resulting HDF5 file." << std::endl;
     return -11;
   }
-  auto filesize = fs::file_size(filePath);
+  const uint64_t usableChunkSize = sfsFile.getUsableChunkSize();
+  const uint64_t filesize = frameData.size();
 
-  // Open the FrameData File
-  std::string absolutPath = fs::absolute(filePath).string();
-  FILE* f = fopen(absolutPath.c_str(), "rb");
-  if(nullptr == f)
-  {
-    std::cout << "Could not open the FrameData File" << std::endl;
-    return -14;
-  }
-
-  // Put the file pointer back to the start of the file
-  rewind(f);
-  FrameDataHeader_t patternHeader;
   std::cout << "Parsing the Pattern Size from the first data Record...." << std::endl;
   // Read the first pattern header which will give us the height & width of the actual pattern data.
-  size_t nRead = fread(&patternHeader, 1, 25, f);
+  FrameDataHeader_t patternHeader;
+  size_t nRead = frameData.read(&patternHeader, 25);
   if(nRead != 25)
   {
     std::cout << "Could not read the Frame Data Header values. Only " << nRead << " values were parsed" << std::endl;
-    fclose(f);
     return -15;
   }
 
   std::cout << "Pattern size is W=" << patternHeader.width << "\tH=" << patternHeader.height << "\tBytes_Per_Pixel=" << patternHeader.bytesPerPixel << std::endl;
-  // Put the file pointer back to the start of the file
-  rewind(f);
 
   int32_t patternDataTupleCount = patternHeader.width * patternHeader.height;
-  // Allocate a row's worth of memory for the pattern data to be read into
-  std::vector<T> patternData(mapWidth * patternHeader.width * patternHeader.height);
+  const size_t patternByteCount = sizeof(T) * patternDataTupleCount;
 
   // ===================================================
   int32_t patternRank = 3;
-  std::array<hsize_t, 3> dims = {static_cast<hsize_t>(mapWidth), static_cast<hsize_t>(ebspHeight), static_cast<hsize_t>(ebspWidth)};
-  std::array<hsize_t, 3> maxdims = {static_cast<hsize_t>(mapWidth * mapHeight), static_cast<hsize_t>(ebspHeight), static_cast<hsize_t>(ebspWidth)};
-  hid_t dataspace = H5Screate_simple(patternRank, dims.data(), maxdims.data());
+  const hsize_t patternCount = static_cast<hsize_t>(mapWidth) * mapHeight;
+  std::array<hsize_t, 3> dims = {patternCount, static_cast<hsize_t>(ebspHeight), static_cast<hsize_t>(ebspWidth)};
+
+  // The rows are written a batch at a time, each batch with a single H5Dwrite
+  const uint64_t rowByteCount = static_cast<uint64_t>(mapWidth) * patternByteCount;
+  const int32_t batchRowCount = static_cast<int32_t>(std::clamp<uint64_t>(k_WriteBatchBytes / std::max<uint64_t>(rowByteCount, 1), 1, std::max(mapHeight, 1)));
+  const size_t batchPatternCount = static_cast<size_t>(batchRowCount) * mapWidth;
+
+  // The dataset is created at its final size. It is only shrunk if the conversion stops early.
+  hid_t dataspace = H5Screate_simple(patternRank, dims.data(), dims.data());
 
   // Modify dataset creation properties, i.e. enable chunking.
-  std::array<hsize_t, 3> chunk_dims = {static_cast<hsize_t>(mapWidth), static_cast<hsize_t>(ebspHeight), static_cast<hsize_t>(ebspWidth)};
+  const hsize_t chunkPatternCount = getChunkPatternCount(chunking, chunkValue, mapWidth, mapHeight, patternByteCount);
+  std::array<hsize_t, 3> chunk_dims = {chunkPatternCount, static_cast<hsize_t>(ebspHeight), static_cast<hsize_t>(ebspWidth)};
   hid_t cparms = H5Pcreate(H5P_DATASET_CREATE);
   herr_t status = H5Pset_chunk(cparms, patternRank, chunk_dims.data());
   T fillvalue = 0;
   status = H5Pset_fill_value(cparms, native_type, &fillvalue);
 
+  // Compressed chunks are normally built by a pool of threads and stored as they are. Without
+  // H5Dwrite_chunk() HDF5 compresses them itself, on this thread.
+  const bool compress = compressionLevel > 0;
+  const bool writeCompressedChunks = compress && k_HasDirectChunkWrite;
+  if(compress)
+  {
+    status = H5Pset_shuffle(cparms);
+    status = H5Pset_deflate(cparms, static_cast<unsigned>(std::min(compressionLevel, 9)));
+  }
+
+  // A row sized chunk is written straight through. Smaller or larger chunks need a cache that holds them.
+  hid_t dapl = H5Pcreate(H5P_DATASET_ACCESS);
+  if(chunkPatternCount != static_cast<hsize_t>(mapWidth) && !writeCompressedChunks)
+  {
+    setPatternChunkCache(dapl, chunkPatternCount, batchPatternCount, patternByteCount);
+  }
+
   // Create a new dataset within the file using cparms creation properties.
-  hid_t dataset = H5Dcreate2(dataGrpId, Bruker::IndexingResults::EBSP.c_str(), native_type, dataspace, H5P_DEFAULT, cparms, H5P_DEFAULT);
-  hid_t filespace = 0;
+  hid_t dataset = H5Dcreate2(dataGrpId, Bruker::IndexingResults::EBSP.c_str(), native_type, dataspace, H5P_DEFAULT, cparms, dapl);
+  if(dataset < 0)
+  {
+    std::cout << "The pattern dataset with " << chunkPatternCount << " patterns per chunk could not be created" << std::endl;
+    H5Sclose(dataspace);
+    H5Pclose(cparms);
+    H5Pclose(dapl);
+    return k_PatternDatasetError;
+  }
+  hid_t filespace = H5Dget_space(dataset);
 
-  size_t beamIdx = 0;
-  for(int32_t y = 0; y < mapHeight; y++)
+  // The same memory space serves every batch. Only the last batch can be shorter.
+  std::array<hsize_t, 3> batchDims = {static_cast<hsize_t>(batchPatternCount), static_cast<hsize_t>(ebspHeight), static_cast<hsize_t>(ebspWidth)};
+  hid_t memspace = H5Screate_simple(patternRank, batchDims.data(), nullptr);
+
+  const std::string dataFileName = fs::path(dataFile).filename().string();
+  const size_t patternTupleStride = static_cast<size_t>(ebspWidth) * ebspHeight;
+  uint64_t bytesSinceDrop = 0;
+  SFSConsoleProgress console;
+  SFSProgressReporter progress(observer != nullptr ? observer : &console, "Writing " + dataFileName, rowByteCount * mapHeight);
+
+  // ===================================================
+  // The rows move through a pipeline so that reading, flipping and writing overlap. A reader thread fills
+  // buffers of a batch of rows with patterns, a few workers flip them if needed and this thread, the only one
+  // that talks to HDF5, writes the batches in order. The buffers are handed back to the reader once written,
+  // so memory use stays bounded.
+  struct RowBatch
+  {
+    size_t buffer = 0;
+    int32_t firstRow = 0;
+    int32_t rowCount = 0;
+    bool last = false; // A pattern could not be read, so nothing after this batch is converted
+  };
+  const uint64_t batchByteCount = static_cast<uint64_t>(batchRowCount) * rowByteCount;
+  const size_t flipThreadCount = flipPatterns ? std::min(ThreadPool::DefaultThreadCount(), k_MaxFlipThreads) : 0;
+  // Sorted reads fill several batches at once. Two groups of batches are kept in flight so that one is read
+  // while the other is flipped and written.
+  const size_t sortedGroupSize = sortedReads ? static_cast<size_t>(std::clamp<uint64_t>(k_MaxPipelineBytes / 2 / batchByteCount, 1, (mapHeight + batchRowCount - 1) / batchRowCount)) : 1;
+  const size_t bufferCount = std::max(static_cast<size_t>(std::clamp<uint64_t>(k_MaxPipelineBytes / batchByteCount, 3, flipThreadCount + 3)), 2 * sortedGroupSize);
+  std::vector<std::vector<T>> batchBuffers(bufferCount, std::vector<T>(batchPatternCount * patternTupleStride));
+  BoundedQueue<RowBatch> freeBatches(bufferCount);
+  BoundedQueue<RowBatch> readBatches(bufferCount);
+  BoundedQueue<RowBatch> doneBatches(bufferCount);
+  for(size_t i = 0; i < bufferCount; i++)
   {
-    std::cout << filePath.filename() << " Writing Row " << y << "/" << mapHeight << "\r";
-    std::cout.flush();
+    freeBatches.push(RowBatch{i});
+  }
 
-    for(int32_t x = 0; x < mapWidth; x++)
+  // Without flipping the batches go straight from the reader to the writer
+  BoundedQueue<RowBatch>& readerOutput = flipPatterns ? readBatches : doneBatches;
+  auto reportReadError = [&](uint64_t filePos, size_t patternBytesRead) {
+    std::cout << "Unexpected End of File (EOF) was encountered. Details follow" << std::endl;
+    std::cout << "File Size: " << filesize << std::endl;
+    printf("File Pos When Reading: %llu\n", static_cast<unsigned long long int>(filePos + 25));
+    std::cout << "error reading data file: nRead=" << patternBytesRead << " but needed: " << patternByteCount << std::endl;
+    std::cout << "X,Y Position from Pattern Header: " << patternHeader.xIndex << " , " << patternHeader.yIndex << std::endl;
+  };
+  auto readPatterns = [&]() {
+    size_t beamIdx = 0;
+    RowBatch batch;
+    for(int32_t firstRow = 0; firstRow < mapHeight && freeBatches.pop(batch); firstRow += batchRowCount)
     {
-      fpos_t pos;
-      size_t patternDataPtrOffset = x * ebspWidth * ebspHeight;
-      uint64_t filePos = frameDescription[beamIdx++];        // Get the file position of the pattern
-      if(filePos != 0xFFFFFFFFFFFFFFFF)
+      batch.firstRow = firstRow;
+      batch.rowCount = std::min(batchRowCount, mapHeight - firstRow);
+      for(int32_t row = 0; row < batch.rowCount && !batch.last; row++)
       {
-        fseek(f, filePos + 25, SEEK_SET);                                       // Set the file position to the pattern data
-        // Compute the index into the current pattern vector to store the pattern
-        // Read the Data associated with the header that was read.
-        fgetpos(f, &pos);
-
-        if(flipPatterns)
+        for(int32_t x = 0; x < mapWidth; x++)
         {
-          std::vector<T> tiffPatternData(patternDataTupleCount, 0);
-          nRead = fread(tiffPatternData.data(), sizeof(T), patternDataTupleCount, f);
-          size_t targetIndex = 0;
-          T* targetPattern = patternData.data() + patternDataPtrOffset;
-          for(int h = patternHeader.height -1; h >= 0; h--)
+          T* targetPattern = batchBuffers[batch.buffer].data() + (static_cast<size_t>(row) * mapWidth + x) * patternTupleStride;
+          uint64_t filePos = frameDescription[beamIdx++]; // Get the file position of the pattern
+          if(filePos == 0xFFFFFFFFFFFFFFFF)
+          {
+            // Write ZEROS to the pattern data
+            std::memset(targetPattern, 0x00, patternByteCount);
+            continue;
+          }
+          // Use the bytes in place if the pattern lives inside a single chunk of a memory mapped container
+          std::span<const uint8_t> source = getMemberView(*frameDataNode, filePos + 25, patternByteCount, usableChunkSize);
+          size_t patternBytesRead = source.size();
+          if(source.empty())
+          {
+            frameData.seek(filePos + 25); // Set the position to the pattern data
+            patternBytesRead = frameData.read(targetPattern, patternByteCount);
+          }
+          else
+          {
+            ::memcpy(targetPattern, source.data(), patternByteCount);
+          }
+          if(patternBytesRead != patternByteCount)
           {
-            size_t pIndex = h * patternHeader.width;
-            T* sourcePatternRowPtr = &tiffPatternData[pIndex];
-            T* targetPatternRowPtr = &targetPattern[targetIndex];
-            ::memcpy(targetPatternRowPtr, sourcePatternRowPtr, sizeof(T) * patternHeader.width);
-            targetIndex += patternHeader.width;
+            reportReadError(filePos, patternBytesRead);
+            batch.rowCount = row + 1;
+            batch.last = true;
+            break;
           }
 #if 0
-SERIOUSLY: DO NOT UNCOMMENT THIS UNLESS YOU WANT TO KILL YOUR COMPUTER
-          std::stringstream ss;
-          ss << "/tmp/pattern_" << x << "_" << y << ".tiff";
-          std::pair<int32_t, std::string> result = ::WriteGrayScaleImage(ss.str(), patternHeader.width, patternHeader.height, patternData.data() + patternDataPtrOffset);
-          if(result.first < 0)
+// This section is for writing patterns to a tiff file. ONLY DO THIS IF YOU ARE IN
+// A DEBUGGER STEPPING THROUGH THE CODE. Dumping a few hundred thousand files onto
+// your desktop is not going to end well for ANY operating system, yes, Linux included.
           {
-            std::cout << result.second << std::endl;
+            std::stringstream ss;
+            ss << "/tmp/pattern_" << x << "_" << (firstRow + row) << ".tiff";
+            std::pair<int32_t, std::string> result = ::WriteGrayScaleImage(ss.str(), patternHeader.width, patternHeader.height, targetPattern);
+            if(result.first < 0)
+            {
+              std::cout << result.second << std::endl;
+            }
           }
 #endif
         }
-        else
+      }
+      if(!readerOutput.push(batch) || batch.last)
+      {
+        break;
+      }
+    }
+    readerOutput.close();
+  };
+
+  // Reads the patterns of a group of batches in the order they are stored in the FrameData file, so the file
+  // is streamed front to back in large reads instead of being visited in scan order
+  auto readSortedPatterns = [&]() {
+    const int32_t groupRowCount = static_cast<int32_t>(sortedGroupSize) * batchRowCount;
+    std::vector<RowBatch> group;
+    std::vector<std::pair<uint64_t, size_t>> patterns; // Offset of the pattern data and index within the group
+    std::vector<uint8_t> span;
+    for(int32_t groupFirstRow = 0; groupFirstRow < mapHeight; groupFirstRow += groupRowCount)
+    {
+      const int32_t groupEndRow = std::min(mapHeight, groupFirstRow + groupRowCount);
+      group.clear();
+      RowBatch batch;
+      for(int32_t firstRow = groupFirstRow; firstRow < groupEndRow && freeBatches.pop(batch); firstRow += batchRowCount)
+      {
+        batch.firstRow = firstRow;
+        batch.rowCount = std::min(batchRowCount, groupEndRow - firstRow);
+        group.push_back(batch);
+      }
+      if(group.size() * batchRowCount < static_cast<size_t>(groupEndRow - groupFirstRow))
+      {
+        break;
+      }
+      auto targetPattern = [&](size_t index) { return batchBuffers[group[index / batchPatternCount].buffer].data() + (index % batchPatternCount) * patternTupleStride; };
+
+      const size_t firstIndex = static_cast<size_t>(groupFirstRow) * mapWidth;
+      patterns.clear();
+      for(size_t index = 0; index < static_cast<size_t>(groupEndRow - groupFirstRow) * mapWidth; index++)
+      {
+        uint64_t filePos = frameDescription[firstIndex + index];
+        if(filePos == 0xFFFFFFFFFFFFFFFF)
         {
-          nRead = fread(patternData.data() + patternDataPtrOffset, sizeof(T), patternDataTupleCount, f);
+          // Write ZEROS to the pattern data
+          std::memset(targetPattern(index), 0x00, patternByteCount);
+          continue;
         }
-#if 0
-// This section is for writing patterns to a tiff file. ONLY DO THIS IF YOU ARE IN
-// A DEBUGGER STEPPING THROUGH THE CODE. Dumping a few hundred thousand files onto
-// your desktop is not going to end well for ANY operating system, yes, Linux included.
+        patterns.emplace_back(filePos + 25, index);
+      }
+      std::sort(patterns.begin(), patterns.end());
+
+      // Patterns that are stored close together are fetched with a single read
+      size_t failedIndex = std::numeric_limits<size_t>::max();
+      size_t failedBytesRead = 0;
+      for(size_t first = 0; first < patterns.size();)
+      {
+        const uint64_t spanStart = patterns[first].first;
+        uint64_t spanEnd = spanStart + patternByteCount;
+        size_t end = first + 1;
+        while(end < patterns.size() && patterns[end].first <= spanEnd + k_MaxSortedGapBytes && patterns[end].first + patternByteCount - spanStart <= k_SortedReadBytes)
+        {
+          spanEnd = std::max<uint64_t>(spanEnd, patterns[end].first + patternByteCount);
+          end++;
+        }
+        if(end < patterns.size())
+        {
+          frameDataNode->prefetch(patterns[end].first, k_SortedReadBytes);
+        }
+        span.resize(std::max<size_t>(span.size(), spanEnd - spanStart));
+        const int64_t nRead = std::max<int64_t>(frameDataNode->readData(spanStart, spanEnd - spanStart, span.data()), 0);
+        for(; first < end; first++)
         {
-          fseek(f, filePos + 25, SEEK_SET);                                       // Set the file position to the pattern data
-          // Compute the index into the current pattern vector to store the pattern
-          // Read the Data associated with the header that was read.
-          fgetpos(f, &pos);
-          std::stringstream ss;
-          ss << "/tmp/pattern_" << x << "_" << y << ".tiff";
-          std::vector<uint8_t> tiffPatternData(patternDataTupleCount, 0);
-          nRead = fread(tiffPatternData.data(), sizeof(T), patternDataTupleCount, f);
-
-          std::pair<int32_t, std::string> result = ::WriteGrayScaleImage(ss.str(), patternHeader.width, patternHeader.height, tiffPatternData.data());
-          if(result.first < 0)
+          const uint64_t spanOffset = patterns[first].first - spanStart;
+          const size_t index = patterns[first].second;
+          if(spanOffset + patternByteCount > static_cast<uint64_t>(nRead))
           {
-            std::cout << result.second << std::endl;
+            if(index < failedIndex)
+            {
+              failedIndex = index;
+              failedBytesRead = static_cast<size_t>(std::max<int64_t>(nRead - static_cast<int64_t>(spanOffset), 0));
+            }
+            continue;
           }
+          ::memcpy(targetPattern(index), span.data() + spanOffset, patternByteCount);
         }
-#endif
       }
-      else
+
+      // Nothing after the row of the first pattern in scan order that could not be read is converted
+      size_t endGroup = group.size();
+      if(failedIndex != std::numeric_limits<size_t>::max())
+      {
+        reportReadError(frameDescription[firstIndex + failedIndex], failedBytesRead);
+        endGroup = failedIndex / batchPatternCount + 1;
+        group[endGroup - 1].rowCount = static_cast<int32_t>((failedIndex % batchPatternCount) / mapWidth) + 1;
+        group[endGroup - 1].last = true;
+      }
+      bool pushed = true;
+      for(size_t i = 0; i < endGroup && pushed; i++)
+      {
+        pushed = readerOutput.push(group[i]);
+      }
+      if(!pushed || endGroup != group.size())
       {
-        // Write ZEROS to the pattern data
-        std::memset(patternData.data() + patternDataPtrOffset, 0x00, patternDataTupleCount);
+        break;
+      }
+    }
+    readerOutput.close();
+  };
+
+  std::atomic<size_t> runningFlipThreads = flipThreadCount;
+  auto flipBatches = [&]() {
+    std::vector<T> scratchPattern(patternDataTupleCount);
+    const size_t lineByteCount = sizeof(T) * patternHeader.width;
+    RowBatch batch;
+    while(readBatches.pop(batch))
+    {
+      for(size_t p = 0; p < static_cast<size_t>(batch.rowCount) * mapWidth; p++)
+      {
+        auto* targetPattern = reinterpret_cast<uint8_t*>(batchBuffers[batch.buffer].data() + p * patternTupleStride);
+        ::memcpy(scratchPattern.data(), targetPattern, patternByteCount);
+        const auto* source = reinterpret_cast<const uint8_t*>(scratchPattern.data());
+        size_t targetIndex = 0;
+        for(int h = patternHeader.height - 1; h >= 0; h--)
+        {
+          ::memcpy(targetPattern + targetIndex, source + h * lineByteCount, lineByteCount);
+          targetIndex += lineByteCount;
+        }
       }
+      if(!doneBatches.push(batch))
+      {
+        break;
+      }
+    }
+    if(--runningFlipThreads == 0)
+    {
+      doneBatches.close();
+    }
+  };
 
+  std::future<void> reader = sortedReads ? std::async(std::launch::async, readSortedPatterns) : std::async(std::launch::async, readPatterns);
+  std::vector<std::future<void>> flippers;
+  for(size_t i = 0; i < flipThreadCount; i++)
+  {
+    flippers.push_back(std::async(std::launch::async, flipBatches));
+  }
 
-      if(feof(f) != 0)
+  // Chunks that lie completely inside a batch are compressed straight out of its buffer. A chunk that spans
+  // two batches is assembled in 'partialChunk' first.
+  const uint64_t chunkByteCount = chunkPatternCount * patternByteCount;
+  std::unique_ptr<ThreadPool> compressionPool;
+  if(writeCompressedChunks)
+  {
+    compressionPool = std::make_unique<ThreadPool>(ThreadPool::DefaultThreadCount());
+  }
+  std::vector<uint8_t> partialChunk;
+  uint64_t partialChunkStart = 0;
+  auto compressChunk = [&](std::vector<std::future<std::vector<uint8_t>>>& chunks, const uint8_t* chunk) {
+    chunks.push_back(compressionPool->submit([chunk, chunkByteCount, compressionLevel]() { return compressPatternChunk(chunk, chunkByteCount, sizeof(T), std::min(compressionLevel, 9)); }));
+  };
+  // Compresses and stores the chunks of 'patternCount' patterns starting at 'firstPattern'. 'flush' also stores
+  // a chunk that is only partly filled.
+  auto writeChunks = [&](const uint8_t* data, uint64_t firstPattern, uint64_t patternCount, bool flush) {
+    std::vector<hsize_t> chunkOffsets;
+    std::vector<std::future<std::vector<uint8_t>>> chunks;
+    std::vector<std::vector<uint8_t>> assembledChunks;
+    assembledChunks.reserve(2);
+    const uint64_t endPattern = firstPattern + patternCount;
+    for(uint64_t pattern = firstPattern; pattern < endPattern;)
+    {
+      const uint64_t chunkStart = pattern / chunkPatternCount * chunkPatternCount;
+      const uint64_t chunkEnd = std::min<uint64_t>(chunkStart + chunkPatternCount, dims[0]);
+      const uint64_t copyEnd = std::min(chunkEnd, endPattern);
+      const uint8_t* source = data + (pattern - firstPattern) * patternByteCount;
+      if(pattern == chunkStart && copyEnd == chunkStart + chunkPatternCount)
       {
-        std::cout << "Unexpected End of File (EOF) was encountered. Details follow" << std::endl;
-        std::cout << "File Size: " << filesize << std::endl;
-        std::cout << "ferror(f) = " << ferror(f) << "  feof(f) = " << feof(f) << std::endl;
-        // std::cout << "File Pos When Reading: " << static_cast<size_t>(pos) << std::endl;
-        printf("File Pos When Reading: %llu\n", static_cast<unsigned long long int>(BDL_POS(pos)));
-        fgetpos(f, &pos);
-        std::cout << "error reading data file: nRead=" << nRead << " but needed: " << patternDataTupleCount << std::endl;
-        printf(" Current File Position: %llu\n", static_cast<unsigned long long int>(BDL_POS(pos)));
-        std::cout << "X,Y Position from Pattern Header: " << patternHeader.xIndex << " , " << patternHeader.yIndex << std::endl;
-        y = mapHeight;
-        x = mapWidth;
-        break;
+        compressChunk(chunks, source);
+      }
+      else
+      {
+        // The unused end of the last chunk of the dataset stays zero
+        partialChunk.resize(chunkByteCount, 0);
+        partialChunkStart = chunkStart;
+        ::memcpy(partialChunk.data() + (pattern - chunkStart) * patternByteCount, source, (copyEnd - pattern) * patternByteCount);
+        if(copyEnd == chunkEnd || flush)
+        {
+          assembledChunks.push_back(std::move(partialChunk));
+          partialChunk.clear();
+          compressChunk(chunks, assembledChunks.back().data());
+        }
+      }
+      if(chunks.size() > chunkOffsets.size())
+      {
+        chunkOffsets.push_back(chunkStart);
+      }
+      pattern = copyEnd;
+    }
+    if(flush && !partialChunk.empty())
+    {
+      assembledChunks.push_back(std::move(partialChunk));
+      partialChunk.clear();
+      compressChunk(chunks, assembledChunks.back().data());
+      chunkOffsets.push_back(partialChunkStart);
+    }
+    // The chunks are stored in order while the ones after them are still being compressed
+    bool written = true;
+    for(size_t i = 0; i < chunks.size(); i++)
+    {
+      std::vector<uint8_t> compressed = chunks[i].get();
+      std::array<hsize_t, 3> chunkOffset = {chunkOffsets[i], 0, 0};
+      if(written && (compressed.empty() || H5Dwrite_chunk(dataset, H5P_DEFAULT, 0, chunkOffset.data(), compressed.size(), compressed.data()) < 0))
+      {
+        std::cout << "Could not write the compressed patterns starting at pattern " << chunkOffsets[i] << std::endl;
+        written = false;
       }
     }
+    return written;
+  };
+
+  // The flip workers can finish batches out of order. Batches that arrive early wait here for their turn.
+  std::map<int32_t, RowBatch> pendingBatches;
+  int32_t rowsWritten = 0;
+  bool lastBatch = false;
+  RowBatch doneBatch;
+  while(!lastBatch && doneBatches.pop(doneBatch))
+  {
+    pendingBatches.emplace(doneBatch.firstRow, doneBatch);
+    for(auto iter = pendingBatches.find(rowsWritten); iter != pendingBatches.end() && !lastBatch; iter = pendingBatches.find(rowsWritten))
+    {
+      if(progress.isCanceled())
+      {
+        err = SFSProgressObserver::k_CanceledError;
+        lastBatch = true;
+        break;
+      }
+      const RowBatch& batch = iter->second;
 
-    // Extend the dataset.
-    std::array<hsize_t, 3> size = {static_cast<hsize_t>(mapWidth * (y + 1)), static_cast<hsize_t>(ebspHeight), static_cast<hsize_t>(ebspWidth)};
-    status = H5Dset_extent(dataset, size.data());
+      if(writeCompressedChunks)
+      {
+        const auto* data = reinterpret_cast<const uint8_t*>(batchBuffers[batch.buffer].data());
+        if(!writeChunks(data, static_cast<uint64_t>(batch.firstRow) * mapWidth, static_cast<uint64_t>(batch.rowCount) * mapWidth, batch.last))
+        {
+          err = k_PatternWriteError;
+          lastBatch = true;
+          break;
+        }
+      }
+      else
+      {
+        // Select the rows of the batch in the file and in memory
+        std::array<hsize_t, 3> offset = {static_cast<hsize_t>(batch.firstRow) * mapWidth, 0, 0};
+        std::array<hsize_t, 3> count = {static_cast<hsize_t>(batch.rowCount) * mapWidth, static_cast<hsize_t>(ebspHeight), static_cast<hsize_t>(ebspWidth)};
+        std::array<hsize_t, 3> memOffset = {0, 0, 0};
+        status = H5Sselect_hyperslab(filespace, H5S_SELECT_SET, offset.data(), nullptr, count.data(), nullptr);
+        status = H5Sselect_hyperslab(memspace, H5S_SELECT_SET, memOffset.data(), nullptr, count.data(), nullptr);
+
+        // Write the data to the hyperslab.
+        status = H5Dwrite(dataset, native_type, memspace, filespace, H5P_DEFAULT, batchBuffers[batch.buffer].data());
+      }
 
-    // Select a hyperslab.
-    std::array<hsize_t, 3> offset = {static_cast<hsize_t>(mapWidth * y), 0, 0};
-    filespace = H5Dget_space(dataset);
-    status = H5Sselect_hyperslab(filespace, H5S_SELECT_SET, offset.data(), nullptr, dims.data(), nullptr);
+      const uint64_t batchBytes = static_cast<uint64_t>(batch.rowCount) * rowByteCount;
+      progress.add(batchBytes);
+      bytesSinceDrop += batchBytes;
+      if(directIO && bytesSinceDrop >= k_DropOutputBytes)
+      {
+        dropHdf5FileCache(dataset);
+        bytesSinceDrop = 0;
+      }
 
-    // Define memory space
-    dataspace = H5Screate_simple(patternRank, dims.data(), nullptr);
+      rowsWritten += batch.rowCount;
+      lastBatch = batch.last;
+      freeBatches.push(RowBatch{batch.buffer});
+      pendingBatches.erase(iter);
+    }
+  }
 
-    // Write the data to the hyperslab.
-    status = H5Dwrite(dataset, native_type, dataspace, filespace, H5P_DEFAULT, patternData.data());
+  // Stop the other stages if the writer quit early, then wait for them
+  freeBatches.close();
+  readBatches.close();
+  doneBatches.close();
+  reader.get();
+  for(auto& flipper : flippers)
+  {
+    flipper.get();
+  }
+
+  // A chunk left half filled by a canceled conversion still holds converted patterns
+  if(!partialChunk.empty() && err != k_PatternWriteError)
+  {
+    writeChunks(nullptr, static_cast<uint64_t>(rowsWritten) * mapWidth, 0, true);
+  }
+
+  // Only the rows that were converted are kept
+  if(rowsWritten < mapHeight)
+  {
+    std::array<hsize_t, 3> size = {static_cast<hsize_t>(rowsWritten) * mapWidth, static_cast<hsize_t>(ebspHeight), static_cast<hsize_t>(ebspWidth)};
+    status = H5Dset_extent(dataset, size.data());
+  }
+  if(directIO)
+  {
+    dropHdf5FileCache(dataset);
   }
   // Close/release resources.
   H5Dclose(dataset);
   H5Sclose(dataspace);
   H5Sclose(filespace);
+  H5Sclose(memspace);
   H5Pclose(cparms);
-  // Close our FrameData File
-  fclose(f);
+  H5Pclose(dapl);
 
-  std::cout << std::endl;
-  std::cout.flush();
-  return 0;
+  progress.finish();
+  return err == SFSProgressObserver::k_CanceledError || err == k_PatternWriteError ? err : 0;
 }
 
 // -----------------------------------------------------------------------------
@@ -937,25 +1430,6 @@ void BcfHdf5Convertor::execute()
 {
   const bool k_ShowHdf5Errors = true;
 
-  // We are going to construct a QTemporaryDir _templatepath_ variable so we use a temp
-  // location next to the input file. This *should* be ok for most situations.
-  // Qt will clean up the temp dir when it goes out of scope
-
-  fs::path ifInfo(m_InputFile);
-  ifInfo = fs::absolute(ifInfo);
-  std::string tmpDir = ifInfo.parent_path().string() + "/" + ifInfo.stem().string() + "_XXXXXX";
-
-  std::error_code errorCode;
-  auto result =  fs::create_directory({tmpDir}, errorCode);
-  if(!result && errorCode.value() != 0)
-  {
-    m_ErrorCode = -7000;
-    m_ErrorMessage = std::string("Temp Directory could not be created. ") + tmpDir;
-    return;
-  }
-
-  TempDirectory tempDirectory(tmpDir);
-
   int32_t err = 0;
   hid_t fid = -1;
   bool exists = fs::exists(m_OutputFile);
@@ -1020,58 +1494,50 @@ void BcfHdf5Convertor::execute()
 
 
   SFSReader sfsFile;
+  sfsFile.setUseMemoryMap(m_UseMemoryMap);
+  sfsFile.setUseIndexCache(m_UseIndexCache);
+  sfsFile.setUseDirectIO(m_UseDirectIO);
+  sfsFile.setPrefetchWindow(m_PrefetchWindow);
   sfsFile.parseFile(m_InputFile);
 
   std::stringstream outFileStrm;
 
-  std::cout << "Using Temp Dir: " << tmpDir << std::endl;
-
   outFileStrm.str("");
   outFileStrm << Bruker::Files::EBSDData << "/" << Bruker::Files::FrameDescription;
-  std::string descFile = outFileStrm.str();
-  // std::cout << "Extracting FrameDescription";
-  err = sfsFile.extractFile(tmpDir, descFile);
-  if(err < 0)
+  SFSMemberStream descFile(sfsFile, outFileStrm.str());
+  if(!descFile.isValid())
   {
     m_ErrorCode = -7020;
-    m_ErrorMessage = std::string("Could not extract EBSDData/FrameDescription File.");
+    m_ErrorMessage = std::string("Could not find EBSDData/FrameDescription File.");
     return;
   }
 
   outFileStrm.str("");
   outFileStrm << Bruker::Files::EBSDData << "/" << Bruker::Files::IndexingResults;
-  std::string indexingResultsFile = outFileStrm.str();
-  // std::cout << "Extracting IndexingResults";
-  err = sfsFile.extractFile(tmpDir, indexingResultsFile);
-  if(err < 0)
+  SFSMemberStream indexingResultsFile(sfsFile, outFileStrm.str());
+  if(!indexingResultsFile.isValid())
   {
     m_ErrorCode = -7030;
-    m_ErrorMessage = std::string("Could not extract EBSDData/IndexingResults File.");
+    m_ErrorMessage = std::string("Could not find EBSDData/IndexingResults File.");
     return;
   }
 
   outFileStrm.str("");
   outFileStrm << Bruker::Files::EBSDData << "/" << Bruker::Files::Auxiliarien;
-  std::string auxiliarienFile = outFileStrm.str();
-  // std::cout << "Extracting Auxiliarien";
-  err = sfsFile.extractFile(tmpDir, auxiliarienFile);
-  if(err < 0)
+  SFSMemberStream auxiliarienFile(sfsFile, outFileStrm.str());
+  if(!auxiliarienFile.isValid())
   {
     m_ErrorCode = -7040;
-    m_ErrorMessage = std::string("Could not extract EBSDData/Auxiliarien File.");
+    m_ErrorMessage = std::string("Could not find EBSDData/Auxiliarien File.");
     return;
   }
 
-  outFileStrm.str("");
-  outFileStrm << tmpDir << "/" << Bruker::Files::EBSDData;
-  std::string ebsdDataDir = outFileStrm.str();
-
   // Read the Dimensions of the Map and EBSP
   int32_t mapHeight;
   int32_t mapWidth;
   int32_t ebspHeight;
   int32_t ebspWidth;
-  err = BrukerDataLoader::ReadScanSizes(ebsdDataDir, mapWidth, mapHeight, ebspWidth, ebspHeight);
+  err = BrukerDataLoader::ReadScanSizes(auxiliarienFile, mapWidth, mapHeight, ebspWidth, ebspHeight);
   if(err < 0)
   {
     std::cout << "Error reading Scan Sizes from Description file: " << err << std::endl;
@@ -1097,14 +1563,11 @@ void BcfHdf5Convertor::execute()
     UInt16Array::Pointer indexedBands = UInt16Array::CreateArray(numElements, cDims, Bruker::IndexingResults::NIndexedBands, true);
     FloatArray::Pointer bmm = FloatArray::CreateArray(numElements, cDims, Bruker::IndexingResults::MAD, true);
 
-    descFile = tmpDir + "/" + Bruker::Files::EBSDData + "/" + Bruker::Files::FrameDescription;
-    indexingResultsFile = tmpDir + "/" + Bruker::Files::EBSDData + "/" + Bruker::Files::IndexingResults;
-
     err = BrukerDataLoader::LoadIndexingResults(descFile, indexingResultsFile, indices, eulers, patQual, detectedBands, phases, indexedBands, bmm, mapWidth, mapHeight, roi, m_Reorder);
     if(err < 0)
     {
       m_ErrorCode = -7050;
-      m_ErrorMessage = std::string("Error Reading IndexingResults from extracted file: ");
+      m_ErrorMessage = std::string("Error Reading IndexingResults from the BCF file.");
       return;
     }
 
@@ -1186,11 +1649,8 @@ void BcfHdf5Convertor::execute()
   {
     outFileStrm.str("");
     outFileStrm << Bruker::Files::EBSDData << "/" << Bruker::Files::PhaseList;
-    std::string phaseListFile = outFileStrm.str();
-    // std::cout << "Extracting PhaseList";
-    err = sfsFile.extractFile(tmpDir, phaseListFile);
-    phaseListFile = tmpDir + "/" + phaseListFile;
-    if(err == 0)
+    SFSMemberStream phaseListFile(sfsFile, outFileStrm.str());
+    if(phaseListFile.isValid())
     {
       err = H5Lite::writeScalarDataset(headerGrpId, Bruker::Header::NCOLS, mapWidth);
       err = H5Lite::writeScalarDataset(headerGrpId, Bruker::Header::NROWS, mapHeight);
@@ -1209,16 +1669,13 @@ void BcfHdf5Convertor::execute()
   {
     outFileStrm.str("");
     outFileStrm << Bruker::Files::EBSDData << "/" << Bruker::Files::SEMImage;
-    std::string semFile = outFileStrm.str();
-    // std::cout << "Extracting SEIMImage";
-    err = sfsFile.extractFile(tmpDir, semFile);
-    if(err < 0)
+    SFSMemberStream semFile(sfsFile, outFileStrm.str());
+    if(!semFile.isValid())
     {
       m_ErrorCode = -7060;
-      m_ErrorMessage = std::string("Could not extract EBSDData/SEMImage File.");
+      m_ErrorMessage = std::string("Could not find EBSDData/SEMImage File.");
       return;
     }
-    semFile = tmpDir + "/" + semFile;
 
     writeSEMData(semGrpId, headerGrpId, semFile);
   }
@@ -1227,16 +1684,13 @@ void BcfHdf5Convertor::execute()
   {
     outFileStrm.str("");
     outFileStrm << Bruker::Files::EBSDData << "/" << Bruker::Files::Calibration;
-    std::string semFile = outFileStrm.str();
-    // std::cout << "Extracting Calibration";
-    err = sfsFile.extractFile(tmpDir, semFile);
-    if(err < 0)
+    SFSMemberStream semFile(sfsFile, outFileStrm.str());
+    if(!semFile.isValid())
     {
       m_ErrorCode = -7060;
-      m_ErrorMessage = std::string("Could not extract EBSDData/Calibration File.");
+      m_ErrorMessage = std::string("Could not find EBSDData/Calibration File.");
       return;
     }
-    semFile = tmpDir + "/" + semFile;
 
     float pcx = 0.0f;
     float pcy = 0.0f;
@@ -1258,16 +1712,13 @@ void BcfHdf5Convertor::execute()
   {
     outFileStrm.str("");
     outFileStrm << Bruker::Files::EBSDData << "/" << Bruker::Files::AuxIndexingOptions;
-    std::string semFile = outFileStrm.str();
-    // std::cout << "Extracting AuxIndexingOptions";
-    err = sfsFile.extractFile(tmpDir, semFile);
-    if(err < 0)
+    SFSMemberStream semFile(sfsFile, outFileStrm.str());
+    if(!semFile.isValid())
     {
       m_ErrorCode = -7060;
-      m_ErrorMessage = std::string("Could not extract EBSDData/AuxIndexingOptions File.");
+      m_ErrorMessage = std::string("Could not find EBSDData/AuxIndexingOptions File.");
       return;
     }
-    semFile = tmpDir + "/" + semFile;
 
     writeAuxIndexingOptions(semGrpId, headerGrpId, semFile);
   }
@@ -1277,16 +1728,13 @@ void BcfHdf5Convertor::execute()
   {
     outFileStrm.str("");
     outFileStrm << Bruker::Files::EBSDData << "/" << Bruker::Files::CameraConfiguration;
-    std::string semFile = outFileStrm.str();
-    // std::cout << "Extracting CameraConfiguration";
-    err = sfsFile.extractFile(tmpDir, semFile);
-    if(err < 0)
+    SFSMemberStream semFile(sfsFile, outFileStrm.str());
+    if(!semFile.isValid())
     {
       m_ErrorCode = -7060;
-      m_ErrorMessage = std::string("Could not extract EBSDData/CameraConfiguration File.");
+      m_ErrorMessage = std::string("Could not find EBSDData/CameraConfiguration File.");
       return;
     }
-    semFile = tmpDir + "/" + semFile;
 
     writeCameraConfiguration(semGrpId, headerGrpId, semFile);
     // Get the Pattern Pixel Byte Count
@@ -1298,11 +1746,26 @@ void BcfHdf5Convertor::execute()
   std::string dataFile = outFileStrm.str();
   if(pixelByteCount == 1)
   {
-    writePatternData<uint8_t>(sfsFile, H5T_NATIVE_UINT8, mapWidth, mapHeight, ebspWidth, ebspHeight, m_FlipPatterns, tmpDir, dataFile, descFile, dataGrpId);
+    err = writePatternData<uint8_t>(sfsFile, H5T_NATIVE_UINT8, mapWidth, mapHeight, ebspWidth, ebspHeight, m_FlipPatterns, m_SortPatternReads, m_PatternChunking, m_PatternChunkValue, m_CompressionLevel, dataFile, descFile, dataGrpId, m_ProgressObserver);
   }
   else if(pixelByteCount == 2)
   {
-    writePatternData<uint16_t>(sfsFile, H5T_NATIVE_UINT16, mapWidth, mapHeight, ebspWidth, ebspHeight, m_FlipPatterns, tmpDir, dataFile, descFile, dataGrpId);
+    err = writePatternData<uint16_t>(sfsFile, H5T_NATIVE_UINT16, mapWidth, mapHeight, ebspWidth, ebspHeight, m_FlipPatterns, m_SortPatternReads, m_PatternChunking, m_PatternChunkValue, m_CompressionLevel, dataFile, descFile, dataGrpId, m_ProgressObserver);
+  }
+  if(err == SFSProgressObserver::k_CanceledError)
+  {
+    m_ErrorCode = err;
+    m_ErrorMessage = std::string("The conversion was canceled.");
+  }
+  else if(err == k_PatternWriteError)
+  {
+    m_ErrorCode = -7070;
+    m_ErrorMessage = std::string("Could not write the compressed pattern data.");
+  }
+  else if(err == k_PatternDatasetError)
+  {
+    m_ErrorCode = -7071;
+    m_ErrorMessage = std::string("Could not create the pattern dataset.");
   }
 }
 
@@ -1,10 +1,28 @@
 #pragma once
 
+#include <cstdint>
 #include <string>
 
+#include "SFSReader.h"
+
+class SFSProgressObserver;
+
 class BcfHdf5Convertor
 {
 public:
+  static constexpr uint64_t k_DefaultChunkBytes = 2 * 1024 * 1024;
+  static constexpr uint64_t k_MaxChunkBytes = 0xFFFFFFFFULL; // HDF5 chunks must be smaller than 4 GiB
+
+  /**
+   * @brief How the patterns dataset is split into HDF5 chunks
+   */
+  enum class PatternChunking
+  {
+    Row,      // One chunk per row of the map
+    Patterns, // A fixed number of patterns per chunk. 1 makes every pattern its own chunk.
+    Bytes     // As many whole patterns per chunk as fit in a byte target
+  };
+
   BcfHdf5Convertor(std::string inputFile, std::string outputFile);
   ~BcfHdf5Convertor();
 
@@ -15,6 +33,46 @@ public:
 
   void setReorder(bool reorder);
   void setFlipPatterns(bool flipPatterns);
+
+  /**
+   * @brief setSortPatternReads Reads the patterns of a batch of rows in the order they are stored in the
+   * FrameData file instead of in scan order. The file is then streamed front to back in large reads, which is
+   * much faster on spinning disks and network storage where the pattern offsets jump around.
+   * @param sortPatternReads
+   */
+  void setSortPatternReads(bool sortPatternReads);
+
+  void setUseMemoryMap(bool useMemoryMap);
+  void setUseIndexCache(bool useIndexCache);
+  void setUseDirectIO(bool useDirectIO);
+  void setPrefetchWindow(uint64_t prefetchWindow);
+
+  /**
+   * @brief setPatternChunking Selects the HDF5 chunk layout of the patterns dataset. 'value' is the number of
+   * patterns for PatternChunking::Patterns and the byte target for PatternChunking::Bytes. It is ignored for
+   * PatternChunking::Row, the default. Chunks smaller than a row keep the file readable one pattern at a time
+   * without pulling a whole row, and the chunk cache is sized so the chunks a row touches are written out once.
+   * @param chunking
+   * @param value
+   */
+  void setPatternChunking(PatternChunking chunking, uint64_t value);
+
+  /**
+   * @brief setCompressionLevel Stores the patterns with the HDF5 shuffle and deflate filters at the given zlib
+   * level (1 to 9). 0, the default, leaves them uncompressed. The chunks are compressed by a pool of threads and
+   * stored with H5Dwrite_chunk(), so any HDF5 tool can still read the file.
+   * @param compressionLevel
+   */
+  void setCompressionLevel(int32_t compressionLevel);
+
+  /**
+   * @brief setProgressObserver Sends the progress of the pattern conversion to 'observer' instead of std::cout.
+   * The observer may cancel the conversion, which takes effect at the next batch of rows (about 64 MB of
+   * patterns) and sets the error code to SFSProgressObserver::k_CanceledError. The convertor does not take ownership of the observer.
+   * @param observer
+   */
+  void setProgressObserver(SFSProgressObserver* observer);
+
   void execute();
 
   int32_t getErrorCode() const;
@@ -28,4 +86,13 @@ private:
   int32_t m_ErrorCode = 0;
   bool m_Reorder = false;
   bool m_FlipPatterns = false;
+  bool m_SortPatternReads = false;
+  bool m_UseMemoryMap = false;
+  bool m_UseIndexCache = false;
+  bool m_UseDirectIO = false;
+  uint64_t m_PrefetchWindow = SFSReader::k_DefaultPrefetchWindow;
+  PatternChunking m_PatternChunking = PatternChunking::Row;
+  uint64_t m_PatternChunkValue = 0;
+  int32_t m_CompressionLevel = 0;
+  SFSProgressObserver* m_ProgressObserver = nullptr;
 };
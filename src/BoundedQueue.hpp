@@ -0,0 +1,112 @@
+/* ============================================================================
+ * Copyright (c) 2019 BlueQuartz Software, LLC
+ * All rights reserved.
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with any project and source this library is coupled.
+ * If not, see <https://www.gnu.org/licenses/#GPL>.
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <utility>
+
+/**
+ * @brief The BoundedQueue class hands items from one thread to another. push() blocks while the queue is
+ * full and pop() blocks while it is empty, so a fast producer can never run more than 'capacity' items
+ * ahead of its consumer. Once the queue is closed every blocked call returns.
+ */
+template <typename Item>
+class BoundedQueue
+{
+public:
+  /**
+   * @brief Creates a queue that holds at most 'capacity' items. At least one item always fits.
+   * @param capacity
+   */
+  explicit BoundedQueue(size_t capacity)
+  : m_Capacity(std::max<size_t>(capacity, 1))
+  {
+  }
+
+  BoundedQueue(const BoundedQueue&) = delete;            // Copy Constructor Not Implemented
+  BoundedQueue(BoundedQueue&&) = delete;                 // Move Constructor Not Implemented
+  BoundedQueue& operator=(const BoundedQueue&) = delete; // Copy Assignment Not Implemented
+  BoundedQueue& operator=(BoundedQueue&&) = delete;      // Move Assignment Not Implemented
+
+  /**
+   * @brief push Appends 'item', waiting for room if the queue is full
+   * @param item
+   * @return false if the queue was closed, in which case the item is dropped
+   */
+  bool push(Item item)
+  {
+    {
+      std::unique_lock<std::mutex> lock(m_Mutex);
+      m_NotFull.wait(lock, [this]() { return m_Closed || m_Items.size() < m_Capacity; });
+      if(m_Closed)
+      {
+        return false;
+      }
+      m_Items.push_back(std::move(item));
+    }
+    m_NotEmpty.notify_one();
+    return true;
+  }
+
+  /**
+   * @brief pop Takes the oldest item, waiting for one if the queue is empty
+   * @param item
+   * @return false once the queue is closed and holds no more items
+   */
+  bool pop(Item& item)
+  {
+    {
+      std::unique_lock<std::mutex> lock(m_Mutex);
+      m_NotEmpty.wait(lock, [this]() { return m_Closed || !m_Items.empty(); });
+      if(m_Items.empty())
+      {
+        return false;
+      }
+      item = std::move(m_Items.front());
+      m_Items.pop_front();
+    }
+    m_NotFull.notify_one();
+    return true;
+  }
+
+  /**
+   * @brief close Wakes every waiting thread. Later pushes fail and pops only drain what is left.
+   */
+  void close()
+  {
+    {
+      std::lock_guard<std::mutex> lock(m_Mutex);
+      m_Closed = true;
+    }
+    m_NotEmpty.notify_all();
+    m_NotFull.notify_all();
+  }
+
+private:
+  size_t m_Capacity = 1;
+  std::deque<Item> m_Items;
+  std::mutex m_Mutex;
+  std::condition_variable m_NotEmpty;
+  std::condition_variable m_NotFull;
+  bool m_Closed = false;
+};
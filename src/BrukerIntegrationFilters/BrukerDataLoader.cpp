@@ -234,44 +234,32 @@ EbsdPatterns::Pointer BrukerDataLoader::LoadPatternData(const std::string& descF
 #endif
 
 // -----------------------------------------------------------------------------
-int BrukerDataLoader::LoadIndexingResults(const std::string& descFile, const std::string& dataFile, const UInt16Array::Pointer& positions, const FloatArray::Pointer& eulers,
+int BrukerDataLoader::LoadIndexingResults(SFSMemberStream& descFile, SFSMemberStream& dataFile, const UInt16Array::Pointer& positions, const FloatArray::Pointer& eulers,
                                           const FloatArray::Pointer& patQual, const UInt16Array::Pointer& detectedBands, const Int16Array::Pointer& phase,
                                           const UInt16Array::Pointer& indexedBands, const FloatArray::Pointer& bmm, int32_t& mapWidth, int32_t& mapHeight, std::vector<uint16_t>& roi,
                                           bool reorder)
 {
-
-  fs::path descFileInfo(descFile);
-  if(!fs::exists(descFileInfo))
+  if(!descFile.isValid())
   {
-    std::cout << "The FrameDescription File does not exist: '" << descFile << "'";
+    std::cout << "The FrameDescription File does not exist: '" << descFile.getPath() << "'";
     return -1000;
   }
 
-  fs::path dataFileInfo(dataFile);
-  if(!fs::exists(dataFileInfo))
+  if(!dataFile.isValid())
   {
-    std::cout << "The Indexing Result File does not exist: '" << dataFile << "'";
+    std::cout << "The Indexing Result File does not exist: '" << dataFile.getPath() << "'";
     return -1001;
   }
 
-  FILE* desc = fopen(descFile.c_str(), "rb");
-  if (nullptr == desc)
-  {
-    std::cout << "Could not open the FrameDescription File";
-    return -1003;
-  }
-
   // Get the total number of scan points from the FrameData file
   FrameDescriptionHeader_t descHeader;
-  size_t nRead = fread(&descHeader, sizeof(int32_t), 3, desc);
+  descFile.seek(0);
+  size_t nRead = descFile.read(&descHeader, sizeof(int32_t) * 3) / sizeof(int32_t);
   if (nRead != 3)
   {
     std::cout << "Could not read the header values. Only " << nRead  << " values were parsed";
-    fclose(desc);
     return -1004;
   }
-  fclose(desc);
-  desc = nullptr;
 
   mapWidth = descHeader.width;
   mapHeight = descHeader.height;
@@ -298,14 +286,8 @@ int BrukerDataLoader::LoadIndexingResults(const std::string& descFile, const std
   float* bmmPtr = bmm->getPointer(0);
   bmm->initializeWithZeros();
 
-  int64_t filesize = static_cast<int64_t>(fs::file_size(dataFileInfo));
-
-  FILE* f = fopen(dataFile.c_str(), "rb");
-  if(nullptr == f)
-  {
-    std::cout << "Could not open Indexing Results file at " << dataFile;
-    return -1005;
-  }
+  uint64_t filesize = dataFile.size();
+  dataFile.seek(0);
 
   nRead = 0;
 
@@ -317,27 +299,19 @@ int BrukerDataLoader::LoadIndexingResults(const std::string& descFile, const std
   uint16_t minY = std::numeric_limits<uint16_t>::max();
   uint16_t maxY = std::numeric_limits<uint16_t>::min();
   size_t scannedPointCount = 0;
-  fpos_t pos;
-  fgetpos(f, &pos);
-
-#if defined(__WIN32__) || defined (__APPLE__)
-while(pos < filesize)
-#else
-while(pos.__pos < filesize)
-#endif
 
+  while(dataFile.tell() < filesize)
   {
     ::memset(data, 0, 30); // Splat zeros across the structure.
-    nRead = fread(&data, 1, 30, f);
-    if(feof(f) != 0)
+    uint64_t pos = dataFile.tell();
+    nRead = dataFile.read(data, 30);
+    if(nRead != 30)
     {
       std::cout << "BrukerDataLoader: "
                 << "Unexpected End of File (EOF) was encountered. Details follow" << std::endl;
-      std::cout << "  ferror(f) = " << ferror(f) << "  feof(f) = " << feof(f) << std::endl;
-      // std::cout << "File Pos When Reading: " << static_cast<size_t>(pos) << std::endl;
-      printf("  File Pos When Reading: %llu\n", static_cast<unsigned long long int>(BDL_POS(pos)));
-      fgetpos(f, &pos);
-      printf("  Current File Position: %llu\n", static_cast<unsigned long long int>(BDL_POS(pos)));
+      std::cout << "  File Size: " << filesize << "  nRead = " << nRead << std::endl;
+      printf("  File Pos When Reading: %llu\n", static_cast<unsigned long long int>(pos));
+      printf("  Current File Position: %llu\n", static_cast<unsigned long long int>(dataFile.tell()));
       break;
     }
     scannedPointCount++;
@@ -378,7 +352,6 @@ while(pos.__pos < filesize)
     idxBnds[index] = record->indexedBands;
     bmmPtr[index] = record->bmm;
     index++;
-    fgetpos(f, &pos);
 
     //      if((y != record->yIndex || x != record->xIndex) && debug)
     //      {
@@ -396,7 +369,6 @@ while(pos.__pos < filesize)
   roi[3] = maxY;
   std::cout << "ROI: (" << minX << ", " << minY << ") -> (" << maxX << ", " << maxY << ")" << std::endl;
   std::cout << "Total Measured Points: " << scannedPointCount << std::endl;
-  fclose(f);
   return 0;
 }
 
@@ -409,7 +381,7 @@ void parseIntValue(const std::string& line, int& value)
 
 
 // -----------------------------------------------------------------------------
-int BrukerDataLoader::ReadScanSizes(const std::string& path, int32_t& mapWidth, int32_t& mapHeight,
+int BrukerDataLoader::ReadScanSizes(SFSMemberStream& auxiliarien, int32_t& mapWidth, int32_t& mapHeight,
                                     int32_t& ebspWidth, int32_t& ebspHeight)
 {
   /* The file contents should be the following:
@@ -426,22 +398,13 @@ int BrukerDataLoader::ReadScanSizes(const std::string& path, int32_t& mapWidth,
     MaxRadonBandCount=12
   */
 
-  std::string filePath = path + "/" + Bruker::Files::Auxiliarien;
-  if(!fs::exists(filePath))
+  if(!auxiliarien.isValid())
   {
     return -1;
   }
 
-  std::string contents;
-  {
-    std::ifstream source(filePath);
-
-    source.seekg(0, std::ios::end);
-    contents.reserve(source.tellg());
-    source.seekg(0, std::ios::beg);
-
-    contents.assign((std::istreambuf_iterator<char>(source)), std::istreambuf_iterator<char>());
-  }
+  std::vector<uint8_t> rawContents = auxiliarien.readAll();
+  std::string contents(rawContents.begin(), rawContents.end());
 
   auto list = complex::StringUtilities::split_2(contents,  '\n');
   for(const auto& line : list)
@@ -38,6 +38,7 @@
 
 #include "EbsdPatterns.h"
 #include "EbsdLib/Core/EbsdDataArray.hpp"
+#include "SFSMemberStream.h"
 
 using namespace EbsdLib;
 
@@ -78,9 +79,9 @@ class BrukerDataLoader
     static EbsdPatterns::Pointer LoadPatternData(const std::string& descFileName, const std::string& dataFile);
 
     /**
-     * @brief LoadIndexingResults
-     * @param descFile
-     * @param dataFile
+     * @brief LoadIndexingResults Reads the indexing results straight out of the BCF container
+     * @param descFile Stream over the FrameDescription member
+     * @param dataFile Stream over the IndexingResults member
      * @param positions
      * @param eulers
      * @param patQual
@@ -92,20 +93,21 @@ class BrukerDataLoader
      * @param mapHeight
      * @return
      */
-    static int LoadIndexingResults(const std::string& descFile, const std::string& dataFile, const UInt16Array::Pointer& positions, const FloatArray::Pointer& eulers,
+    static int LoadIndexingResults(SFSMemberStream& descFile, SFSMemberStream& dataFile, const UInt16Array::Pointer& positions, const FloatArray::Pointer& eulers,
                                    const FloatArray::Pointer& patQual, const UInt16Array::Pointer& detectedBands, const Int16Array::Pointer& phase,
                                    const UInt16Array::Pointer& indexedBands, const FloatArray::Pointer& bmm, int32_t& mapWidth, int32_t& mapHeight, std::vector<uint16_t>& roi,
                                    bool reorder = false);
 
     /**
      * @brief ReadScanSizes
+     * @param auxiliarien Stream over the Auxiliarien member
      * @param mapWidth
      * @param mapHeight
      * @param ebspWidth
      * @param ebspHeight
      * @return
      */
-    static int ReadScanSizes(const std::string &path, int32_t &mapWidth, int32_t &mapHeight, int32_t &ebspWidth, int32_t &ebspHeight);
+    static int ReadScanSizes(SFSMemberStream& auxiliarien, int32_t &mapWidth, int32_t &mapHeight, int32_t &ebspWidth, int32_t &ebspHeight);
 
     /**
      * @brief VerifyRequiredFiles
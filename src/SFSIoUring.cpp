@@ -0,0 +1,299 @@
+/* ============================================================================
+ * Copyright (c) 2019 BlueQuartz Software, LLC
+ * All rights reserved.
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with any project and source this library is coupled.
+ * If not, see <https://www.gnu.org/licenses/#GPL>.
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+#include "SFSIoUring.h"
+
+#if defined(SFS_USE_IO_URING) && defined(__linux__)
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+namespace
+{
+// -----------------------------------------------------------------------------
+int ioUringSetup(unsigned entries, io_uring_params* params)
+{
+  return static_cast<int>(::syscall(__NR_io_uring_setup, entries, params));
+}
+
+// -----------------------------------------------------------------------------
+int ioUringEnter(int ringFd, unsigned toSubmit, unsigned minComplete, unsigned flags)
+{
+  return static_cast<int>(::syscall(__NR_io_uring_enter, ringFd, toSubmit, minComplete, flags, nullptr, 0));
+}
+} // namespace
+
+// -----------------------------------------------------------------------------
+SFSIoUring::SFSIoUring(uint32_t queueDepth)
+{
+  io_uring_params params;
+  ::memset(&params, 0, sizeof(params));
+  m_RingFd = ioUringSetup(queueDepth, &params);
+  if(m_RingFd < 0)
+  {
+    m_RingFd = -1;
+    return;
+  }
+  m_SqEntries = params.sq_entries;
+
+  m_SqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  m_CqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+  const bool singleMap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+  if(singleMap)
+  {
+    m_SqRingSize = std::max(m_SqRingSize, m_CqRingSize);
+  }
+
+  void* sqRing = ::mmap(nullptr, m_SqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_RingFd, IORING_OFF_SQ_RING);
+  if(sqRing == MAP_FAILED)
+  {
+    ::close(m_RingFd);
+    m_RingFd = -1;
+    return;
+  }
+  m_SqRing = sqRing;
+
+  if(singleMap)
+  {
+    m_CqRing = m_SqRing;
+  }
+  else
+  {
+    void* cqRing = ::mmap(nullptr, m_CqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_RingFd, IORING_OFF_CQ_RING);
+    if(cqRing == MAP_FAILED)
+    {
+      ::munmap(m_SqRing, m_SqRingSize);
+      m_SqRing = nullptr;
+      ::close(m_RingFd);
+      m_RingFd = -1;
+      return;
+    }
+    m_CqRing = cqRing;
+  }
+
+  m_SqesSize = params.sq_entries * sizeof(io_uring_sqe);
+  void* sqes = ::mmap(nullptr, m_SqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_RingFd, IORING_OFF_SQES);
+  if(sqes == MAP_FAILED)
+  {
+    if(m_CqRing != m_SqRing)
+    {
+      ::munmap(m_CqRing, m_CqRingSize);
+    }
+    ::munmap(m_SqRing, m_SqRingSize);
+    m_SqRing = nullptr;
+    m_CqRing = nullptr;
+    ::close(m_RingFd);
+    m_RingFd = -1;
+    return;
+  }
+  m_Sqes = sqes;
+
+  auto* sqBase = static_cast<uint8_t*>(m_SqRing);
+  m_SqHead = reinterpret_cast<unsigned*>(sqBase + params.sq_off.head);
+  m_SqTail = reinterpret_cast<unsigned*>(sqBase + params.sq_off.tail);
+  m_SqMask = reinterpret_cast<unsigned*>(sqBase + params.sq_off.ring_mask);
+  m_SqArray = reinterpret_cast<unsigned*>(sqBase + params.sq_off.array);
+
+  auto* cqBase = static_cast<uint8_t*>(m_CqRing);
+  m_CqHead = reinterpret_cast<unsigned*>(cqBase + params.cq_off.head);
+  m_CqTail = reinterpret_cast<unsigned*>(cqBase + params.cq_off.tail);
+  m_CqMask = reinterpret_cast<unsigned*>(cqBase + params.cq_off.ring_mask);
+  m_Cqes = cqBase + params.cq_off.cqes;
+}
+
+// -----------------------------------------------------------------------------
+SFSIoUring::~SFSIoUring()
+{
+  if(m_Sqes != nullptr)
+  {
+    ::munmap(m_Sqes, m_SqesSize);
+  }
+  if(m_CqRing != nullptr && m_CqRing != m_SqRing)
+  {
+    ::munmap(m_CqRing, m_CqRingSize);
+  }
+  if(m_SqRing != nullptr)
+  {
+    ::munmap(m_SqRing, m_SqRingSize);
+  }
+  if(m_RingFd >= 0)
+  {
+    ::close(m_RingFd);
+  }
+}
+
+// -----------------------------------------------------------------------------
+bool SFSIoUring::IsSupported()
+{
+  static const bool supported = SFSIoUring(1).isValid();
+  return supported;
+}
+
+// -----------------------------------------------------------------------------
+bool SFSIoUring::isValid() const
+{
+  return m_RingFd >= 0;
+}
+
+// -----------------------------------------------------------------------------
+int32_t SFSIoUring::readAll(intptr_t fd, const std::vector<ReadRequest>& requests)
+{
+  if(!isValid())
+  {
+    return -1;
+  }
+
+  // Bytes read so far for each request. The iovecs must stay put until the kernel has completed the read.
+  std::vector<uint64_t> completed(requests.size(), 0);
+  std::vector<iovec> iovecs(requests.size());
+
+  size_t nextRequest = 0;
+  std::vector<size_t> resubmit;
+  unsigned queued = 0;   // In the submission queue but not yet handed to the kernel
+  unsigned inFlight = 0; // Handed to the kernel but not yet completed
+  int32_t err = 0;
+
+  auto queueRead = [&](size_t index) {
+    const ReadRequest& request = requests[index];
+    const uint64_t done = completed[index];
+    iovecs[index].iov_base = request.dest + done;
+    iovecs[index].iov_len = static_cast<size_t>(request.length - done);
+
+    unsigned tail = *m_SqTail;
+    unsigned slot = tail & *m_SqMask;
+    auto* sqe = static_cast<io_uring_sqe*>(m_Sqes) + slot;
+    ::memset(sqe, 0, sizeof(io_uring_sqe));
+    sqe->opcode = IORING_OP_READV;
+    sqe->fd = static_cast<int>(fd);
+    sqe->addr = reinterpret_cast<uint64_t>(&iovecs[index]);
+    sqe->len = 1;
+    sqe->off = request.offset + done;
+    sqe->user_data = index;
+    m_SqArray[slot] = slot;
+    __atomic_store_n(m_SqTail, tail + 1, __ATOMIC_RELEASE);
+    queued++;
+  };
+
+  while(true)
+  {
+    // Top the submission queue back up unless something already went wrong
+    while(err == 0 && inFlight + queued < m_SqEntries && (!resubmit.empty() || nextRequest < requests.size()))
+    {
+      size_t index = 0;
+      if(!resubmit.empty())
+      {
+        index = resubmit.back();
+        resubmit.pop_back();
+      }
+      else
+      {
+        index = nextRequest++;
+        if(requests[index].length == 0)
+        {
+          continue;
+        }
+      }
+      queueRead(index);
+    }
+    if(inFlight + queued == 0)
+    {
+      break;
+    }
+
+    int submitted = ioUringEnter(m_RingFd, queued, 1, IORING_ENTER_GETEVENTS);
+    if(submitted < 0)
+    {
+      if(errno == EINTR)
+      {
+        continue;
+      }
+      return -1;
+    }
+    queued -= static_cast<unsigned>(submitted);
+    inFlight += static_cast<unsigned>(submitted);
+
+    // Reap every completion that is ready
+    unsigned head = *m_CqHead;
+    unsigned tail = __atomic_load_n(m_CqTail, __ATOMIC_ACQUIRE);
+    while(head != tail)
+    {
+      const auto* cqe = static_cast<const io_uring_cqe*>(m_Cqes) + (head & *m_CqMask);
+      const auto index = static_cast<size_t>(cqe->user_data);
+      const int result = cqe->res;
+      head++;
+      inFlight--;
+
+      if(result == -EINTR || result == -EAGAIN)
+      {
+        resubmit.push_back(index);
+      }
+      else if(result <= 0)
+      {
+        // An error or the end of the file. The reads already in flight are drained but nothing new is queued.
+        err = -1;
+      }
+      else
+      {
+        completed[index] += static_cast<uint64_t>(result);
+        if(completed[index] < requests[index].length)
+        {
+          resubmit.push_back(index);
+        }
+      }
+    }
+    __atomic_store_n(m_CqHead, head, __ATOMIC_RELEASE);
+  }
+  return err;
+}
+
+#else
+
+// -----------------------------------------------------------------------------
+SFSIoUring::SFSIoUring(uint32_t /*queueDepth*/)
+{
+}
+
+// -----------------------------------------------------------------------------
+SFSIoUring::~SFSIoUring() = default;
+
+// -----------------------------------------------------------------------------
+bool SFSIoUring::IsSupported()
+{
+  return false;
+}
+
+// -----------------------------------------------------------------------------
+bool SFSIoUring::isValid() const
+{
+  return false;
+}
+
+// -----------------------------------------------------------------------------
+int32_t SFSIoUring::readAll(intptr_t /*fd*/, const std::vector<ReadRequest>& /*requests*/)
+{
+  return -1;
+}
+
+#endif
@@ -0,0 +1,93 @@
+/* ============================================================================
+ * Copyright (c) 2019 BlueQuartz Software, LLC
+ * All rights reserved.
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with any project and source this library is coupled.
+ * If not, see <https://www.gnu.org/licenses/#GPL>.
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * @brief The SFSIoUring class keeps many positional reads in flight at once through a Linux io_uring
+ * submission queue. It talks to the kernel with the raw io_uring syscalls so no extra library is needed.
+ * Support is compiled in only when SFS_USE_IO_URING is defined (the BCFTools_USE_IO_URING CMake option).
+ * Otherwise, or when the kernel refuses to create a ring, isValid() returns false and callers are
+ * expected to fall back to regular positional reads. A ring must only be used by one thread at a time.
+ */
+class SFSIoUring
+{
+public:
+  struct ReadRequest
+  {
+    uint64_t offset = 0;
+    uint64_t length = 0;
+    uint8_t* dest = nullptr;
+  };
+
+  static constexpr uint32_t k_DefaultQueueDepth = 64;
+
+  explicit SFSIoUring(uint32_t queueDepth = k_DefaultQueueDepth);
+  ~SFSIoUring();
+
+  SFSIoUring(const SFSIoUring&) = delete;            // Copy Constructor Not Implemented
+  SFSIoUring(SFSIoUring&&) = delete;                 // Move Constructor Not Implemented
+  SFSIoUring& operator=(const SFSIoUring&) = delete; // Copy Assignment Not Implemented
+  SFSIoUring& operator=(SFSIoUring&&) = delete;      // Move Assignment Not Implemented
+
+  /**
+   * @brief IsSupported Returns true if io_uring support was compiled in and the running kernel allows
+   * creating a ring. The check is only done once.
+   * @return
+   */
+  static bool IsSupported();
+
+  /**
+   * @brief isValid Returns true if the ring was created
+   * @return
+   */
+  bool isValid() const;
+
+  /**
+   * @brief readAll Reads every request from the file behind 'fd', keeping up to the queue depth of
+   * requests in flight. Short reads are resubmitted for the remaining bytes.
+   * @param fd
+   * @param requests
+   * @return 0 if every request was read completely, -1 on an I/O error or end of file
+   */
+  int32_t readAll(intptr_t fd, const std::vector<ReadRequest>& requests);
+
+private:
+  int m_RingFd = -1;
+  uint32_t m_SqEntries = 0;
+
+  void* m_SqRing = nullptr;
+  size_t m_SqRingSize = 0;
+  void* m_CqRing = nullptr;
+  size_t m_CqRingSize = 0;
+  void* m_Sqes = nullptr;
+  size_t m_SqesSize = 0;
+
+  unsigned* m_SqHead = nullptr;
+  unsigned* m_SqTail = nullptr;
+  unsigned* m_SqMask = nullptr;
+  unsigned* m_SqArray = nullptr;
+  unsigned* m_CqHead = nullptr;
+  unsigned* m_CqTail = nullptr;
+  unsigned* m_CqMask = nullptr;
+  void* m_Cqes = nullptr;
+};
@@ -0,0 +1,189 @@
+/* ============================================================================
+ * Copyright (c) 2019 BlueQuartz Software, LLC
+ * All rights reserved.
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with any project and source this library is coupled.
+ * If not, see <https://www.gnu.org/licenses/#GPL>.
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+#include "SFSMemberStream.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "SFSNodeItem.h"
+#include "SFSReader.h"
+
+// -----------------------------------------------------------------------------
+SFSMemberStream::SFSMemberStream(const SFSReader& reader, const std::string& sfsPath, size_t bufferSize)
+: SFSMemberStream(reader.findNode(sfsPath), bufferSize)
+{
+  m_Path = sfsPath;
+}
+
+// -----------------------------------------------------------------------------
+SFSMemberStream::SFSMemberStream(SFSNodeItemPtr node, size_t bufferSize)
+: m_Node(std::move(node))
+, m_Buffer(bufferSize)
+{
+  if(m_Node != nullptr && m_Node->isDirectory())
+  {
+    m_Node = nullptr;
+  }
+  if(m_Node != nullptr)
+  {
+    m_Path = m_Node->getFileName();
+    m_Size = m_Node->getUncompressedSize();
+  }
+}
+
+// -----------------------------------------------------------------------------
+SFSMemberStream::~SFSMemberStream() = default;
+
+// -----------------------------------------------------------------------------
+bool SFSMemberStream::isValid() const
+{
+  return m_Node != nullptr;
+}
+
+// -----------------------------------------------------------------------------
+const std::string& SFSMemberStream::getPath() const
+{
+  return m_Path;
+}
+
+// -----------------------------------------------------------------------------
+uint64_t SFSMemberStream::size() const
+{
+  return m_Size;
+}
+
+// -----------------------------------------------------------------------------
+uint64_t SFSMemberStream::tell() const
+{
+  return m_Position;
+}
+
+// -----------------------------------------------------------------------------
+bool SFSMemberStream::seek(uint64_t position)
+{
+  if(position > m_Size)
+  {
+    return false;
+  }
+  m_Position = position;
+  return true;
+}
+
+// -----------------------------------------------------------------------------
+bool SFSMemberStream::atEnd() const
+{
+  return m_Position >= m_Size;
+}
+
+// -----------------------------------------------------------------------------
+size_t SFSMemberStream::read(void* dest, size_t length)
+{
+  if(m_Node == nullptr || m_Position >= m_Size || length == 0)
+  {
+    return 0;
+  }
+  length = static_cast<size_t>(std::min<uint64_t>(length, m_Size - m_Position));
+  auto* destPtr = static_cast<uint8_t*>(dest);
+  size_t copied = 0;
+
+  // Serve whatever is already sitting in the read-ahead buffer
+  if(m_Position >= m_BufferStart && m_Position < m_BufferStart + m_BufferLength)
+  {
+    size_t offset = static_cast<size_t>(m_Position - m_BufferStart);
+    size_t count = std::min(length, m_BufferLength - offset);
+    ::memcpy(destPtr, m_Buffer.data() + offset, count);
+    copied += count;
+    m_Position += count;
+  }
+  if(copied == length)
+  {
+    return copied;
+  }
+  m_PrefetchedEnd = m_Node->prefetchAhead(m_Position, m_PrefetchedEnd);
+  if(m_Node->isCompressed())
+  {
+    return copied + readInflated(destPtr + copied, length - copied);
+  }
+
+  size_t remaining = length - copied;
+  if(remaining >= m_Buffer.size())
+  {
+    // Large (or unbuffered) reads go straight into the destination
+    int64_t numRead = m_Node->readData(m_Position, remaining, destPtr + copied);
+    if(numRead <= 0)
+    {
+      return copied;
+    }
+    m_Position += numRead;
+    return copied + static_cast<size_t>(numRead);
+  }
+
+  int64_t numRead = m_Node->readData(m_Position, m_Buffer.size(), m_Buffer.data());
+  if(numRead <= 0)
+  {
+    m_BufferLength = 0;
+    return copied;
+  }
+  m_BufferStart = m_Position;
+  m_BufferLength = static_cast<size_t>(numRead);
+  size_t count = std::min(remaining, m_BufferLength);
+  ::memcpy(destPtr + copied, m_Buffer.data(), count);
+  m_Position += count;
+  return copied + count;
+}
+
+// -----------------------------------------------------------------------------
+size_t SFSMemberStream::readInflated(uint8_t* dest, size_t length)
+{
+  const std::vector<SFSNodeItem::CompressedBlock>& blocks = m_Node->getCompressedBlocks();
+  size_t copied = 0;
+  while(copied < length && !blocks.empty())
+  {
+    // The buffer holds the last inflated block so that small reads do not inflate the same block again
+    const size_t blockIndex = m_Node->findCompressedBlock(m_Position);
+    const SFSNodeItem::CompressedBlock& block = blocks[blockIndex];
+    m_Buffer.resize(block.size);
+    if(m_Node->inflateBlock(blockIndex, m_Buffer.data()) != static_cast<int64_t>(block.size))
+    {
+      m_BufferLength = 0;
+      return copied;
+    }
+    m_BufferStart = block.offset;
+    m_BufferLength = block.size;
+    size_t offset = static_cast<size_t>(m_Position - m_BufferStart);
+    size_t count = std::min(length - copied, m_BufferLength - offset);
+    if(count == 0)
+    {
+      break;
+    }
+    ::memcpy(dest + copied, m_Buffer.data() + offset, count);
+    copied += count;
+    m_Position += count;
+  }
+  return copied;
+}
+
+// -----------------------------------------------------------------------------
+std::vector<uint8_t> SFSMemberStream::readAll()
+{
+  std::vector<uint8_t> data(m_Size, 0);
+  m_Position = 0;
+  data.resize(read(data.data(), data.size()));
+  return data;
+}
@@ -0,0 +1,134 @@
+/* ============================================================================
+ * Copyright (c) 2019 BlueQuartz Software, LLC
+ * All rights reserved.
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with any project and source this library is coupled.
+ * If not, see <https://www.gnu.org/licenses/#GPL>.
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+class SFSReader;
+class SFSNodeItem;
+using SFSNodeItemPtr = std::shared_ptr<SFSNodeItem>;
+
+/**
+ * @brief The SFSMemberStream class gives seekable, random access to a single file inside an SFS
+ * container. All reads go straight to the container through the owning SFSReader so nothing
+ * has to be extracted to disk first. Compressed members are inflated as they are read. Each stream keeps its own position, so separate streams over
+ * the same member may be used from different threads. While a stream is read the next
+ * SFSReader::getPrefetchWindow() bytes of the member are prefetched in the background.
+ */
+class SFSMemberStream
+{
+public:
+  static constexpr size_t k_DefaultBufferSize = 64 * 1024;
+
+  /**
+   * @brief Opens the file at 'sfsPath' inside the container. Check isValid() afterwards.
+   * @param reader
+   * @param sfsPath
+   * @param bufferSize Size of the internal read-ahead buffer. Use 0 for unbuffered access.
+   */
+  SFSMemberStream(const SFSReader& reader, const std::string& sfsPath, size_t bufferSize = k_DefaultBufferSize);
+
+  /**
+   * @brief Opens a stream over an already resolved node.
+   * @param node
+   * @param bufferSize Size of the internal read-ahead buffer. Use 0 for unbuffered access.
+   */
+  explicit SFSMemberStream(SFSNodeItemPtr node, size_t bufferSize = k_DefaultBufferSize);
+
+  ~SFSMemberStream();
+
+  SFSMemberStream(const SFSMemberStream&) = delete;            // Copy Constructor Not Implemented
+  SFSMemberStream(SFSMemberStream&&) = delete;                 // Move Constructor Not Implemented
+  SFSMemberStream& operator=(const SFSMemberStream&) = delete; // Copy Assignment Not Implemented
+  SFSMemberStream& operator=(SFSMemberStream&&) = delete;      // Move Assignment Not Implemented
+
+  /**
+   * @brief isValid Returns true if the member exists and is a regular file
+   * @return
+   */
+  bool isValid() const;
+
+  /**
+   * @brief getPath Returns the path of the member inside the container
+   * @return
+   */
+  const std::string& getPath() const;
+
+  /**
+   * @brief size Returns the size of the member in bytes
+   * @return
+   */
+  uint64_t size() const;
+
+  /**
+   * @brief tell Returns the current read position
+   * @return
+   */
+  uint64_t tell() const;
+
+  /**
+   * @brief seek Moves the read position to 'position' bytes from the start of the member
+   * @param position
+   * @return false if the position is past the end of the member
+   */
+  bool seek(uint64_t position);
+
+  /**
+   * @brief atEnd
+   * @return
+   */
+  bool atEnd() const;
+
+  /**
+   * @brief read Reads up to 'length' bytes from the current position and advances the position
+   * @param dest
+   * @param length
+   * @return The number of bytes read. This is less than 'length' only at the end of the member or on error.
+   */
+  size_t read(void* dest, size_t length);
+
+  /**
+   * @brief readAll Reads the complete member from the start
+   * @return
+   */
+  std::vector<uint8_t> readAll();
+
+private:
+  /**
+   * @brief readInflated Reads from a compressed member one block at a time. The most recently inflated block
+   * stays in the buffer, whatever the buffer size the stream was opened with.
+   * @param dest
+   * @param length
+   * @return The number of bytes read
+   */
+  size_t readInflated(uint8_t* dest, size_t length);
+
+  SFSNodeItemPtr m_Node;
+  std::string m_Path;
+  uint64_t m_Size = 0;
+  uint64_t m_Position = 0;
+
+  std::vector<uint8_t> m_Buffer;
+  uint64_t m_BufferStart = 0;
+  size_t m_BufferLength = 0;
+  uint64_t m_PrefetchedEnd = 0;
+};
@@ -28,18 +28,28 @@
 //#endif
 #endif
 
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <cmath>
 #include <cstdint>
 #include <cstring>
+#include <future>
 #include <iostream>
+#include <mutex>
 
+#include <zlib.h>
+
+#include "SFSIoUring.h"
+#include "SFSProgress.h"
 #include "SFSReader.h"
 #include "SFSUtils.hpp"
+#include "ThreadPool.hpp"
 
 // -----------------------------------------------------------------------------
-SFSNodeItem::SFSNodeItem(const uint8_t* ptr, FILE* fin, SFSReader* reader)
-: m_Reader(reader)
+void SFSNodeItem::setTreeItem(const uint8_t* ptr, SFSReader* reader)
 {
+  m_Reader = reader;
   ::memcpy(&m_PointerTableInit, ptr, 4);
   ::memcpy(&m_FileSize, ptr + 4, 8);
   ::memcpy(&m_FileCreationTime, ptr + 12, 8);
@@ -48,24 +58,58 @@ SFSNodeItem::SFSNodeItem(const uint8_t* ptr, FILE* fin, SFSReader* reader)
   ::memcpy(&m_Permissions, ptr + 36, 4);
   ::memcpy(&m_ParentItemIndex, ptr + 40, 4);
 
-  m_String176 = std::string(reinterpret_cast<const char*>(ptr + 44), 176);
+  const auto* chars = reinterpret_cast<const char*>(ptr);
+  m_String176 = std::string_view(chars + 44, 176);
   ::memcpy(&m_Directory, ptr + 220, 1);
-  m_String3 = std::string(reinterpret_cast<const char*>(ptr + 221));
-  m_FileName = std::string(reinterpret_cast<const char*>(ptr + 224));
-  m_String32 = std::string(reinterpret_cast<const char*>(ptr + 480));
+  m_String3 = std::string_view(chars + 221, ::strnlen(chars + 221, 3));
+  m_FileName = std::string_view(chars + 224, ::strnlen(chars + 224, 256));
+  m_String32 = std::string_view(chars + 480, ::strnlen(chars + 480, 32));
 
   m_ChunkCount = getPointerTableEntryCount();
-
-  if(!m_Directory)
-  {
-    generateFilePointerTable(fin);
-  }
   m_IsValid = true;
 }
 
+// -----------------------------------------------------------------------------
+void SFSNodeItem::setChunkExtents(std::vector<ChunkExtent> chunkExtents)
+{
+  m_ChunkExtents = std::move(chunkExtents);
+  m_IsValid = m_Directory || m_ChunkCount == 0 ||
+              (!m_ChunkExtents.empty() && m_ChunkExtents.front().firstChunk == 0 && m_ChunkExtents.back().firstChunk < static_cast<uint64_t>(m_ChunkCount));
+  // The table is already complete so there is nothing left to load
+  std::call_once(m_FilePointerTableLoaded, []() {});
+}
+
 // -----------------------------------------------------------------------------
 SFSNodeItem::~SFSNodeItem() = default;
 
+// -----------------------------------------------------------------------------
+const std::vector<SFSNodeItem::ChunkExtent>& SFSNodeItem::getChunkExtents() const
+{
+  loadFilePointerTable();
+  return m_ChunkExtents;
+}
+
+// -----------------------------------------------------------------------------
+size_t SFSNodeItem::findExtent(size_t chunkIndex) const
+{
+  auto iter = std::upper_bound(m_ChunkExtents.begin(), m_ChunkExtents.end(), chunkIndex, [](size_t index, const ChunkExtent& extent) { return index < extent.firstChunk; });
+  return static_cast<size_t>(iter - m_ChunkExtents.begin()) - 1;
+}
+
+// -----------------------------------------------------------------------------
+uint64_t SFSNodeItem::getChunkPosition(size_t chunkIndex) const
+{
+  loadFilePointerTable();
+  const ChunkExtent& extent = m_ChunkExtents[findExtent(chunkIndex)];
+  return extent.filePos + (chunkIndex - extent.firstChunk) * static_cast<uint64_t>(m_Reader->getChunkSize());
+}
+
+// -----------------------------------------------------------------------------
+void SFSNodeItem::loadFilePointerTable() const
+{
+  std::call_once(m_FilePointerTableLoaded, [this]() { generateFilePointerTable(); });
+}
+
 // -----------------------------------------------------------------------------
 int32_t SFSNodeItem::getPointerTableEntryCount() const
 {
@@ -120,282 +164,850 @@ inline void hex_dump(const void* aData, std::size_t aLength, std::basic_ostream<
 #endif
 
 // -----------------------------------------------------------------------------
-void SFSNodeItem::generateFilePointerTable(FILE* fin)
+void SFSNodeItem::generateFilePointerTable() const
 {
   //  bool debug = false;
   // m_FileName == "FrameData";
   //  if(debug)
   //    std::cout << "=============================================\n  " << m_FileName << std::endl;
 
+  if(m_Directory || m_ChunkCount == 0)
+  {
+    return;
+  }
+
   size_t readerChunkSize = static_cast<size_t>(m_Reader->getChunkSize());
   size_t readerUsableChunkSize = static_cast<size_t>(m_Reader->getUsableChunkSize());
 
-  int32_t err = 0;
   float denom = std::floor(readerUsableChunkSize / 4.0f);
   float beforeCeil = m_ChunkCount / denom;
   auto chunkCount = static_cast<int32_t>(::ceil(beforeCeil));
   std::vector<uint8_t> buffer(chunkCount * readerUsableChunkSize, 0x00); // Allocate a complete buffer to read the table
   uint8_t* bufferPtr = buffer.data();
   auto ui32Ptr = reinterpret_cast<uint32_t*>(buffer.data());
-  size_t totalBytesRead = 0;
   if(chunkCount > 1)
   {
+    // Each table chunk is read together with its header, which holds the index of the next table chunk
+    std::vector<uint8_t> chunk(readerChunkSize);
     uint32_t nextChunk = m_PointerTableInit;
     for(int i = 0; i < chunkCount; i++)
     {
       size_t offset = readerChunkSize * nextChunk + 280;
-      SFS_UTIL_FSEEK(fin, offset, SEEK_SET);
-      nextChunk = SFSUtils::readScalar<uint32_t>(fin, err);
-      SFS_UTIL_FSEEK(fin, 28, SEEK_CUR);
-
-      if(fread(bufferPtr, 1, readerUsableChunkSize, fin) != readerUsableChunkSize)
+      if(m_Reader->readRaw(offset, readerChunkSize, chunk.data()) != static_cast<int64_t>(readerChunkSize))
       {
         m_IsValid = false;
         return;
       }
-      bufferPtr += readerUsableChunkSize - 1;
-      totalBytesRead += readerUsableChunkSize;
-      //      if(debug)
-      //      {
-      //        std::cout << "  " << i << "  |  File Pos Start: " << offset + 32 << "\t"
-      //                  << "File Pos End: " << offset + 32 + readerUsableChunkSize << "\t"
-      //                  << "Num. UInt32s: " << totalBytesRead / 4 << std::endl;
-
-      //        if(totalBytesRead / 4 > 230687)
-      //        {
-      //          std::cout << ui32Ptr[230687] * readerChunkSize + 312ULL << "\t" << ui32Ptr[230688] * readerChunkSize + 312ULL << std::endl;
-
-      //          neolib::hex_dump(ui32Ptr + 230687, 8, std::cout);
-      //        }
-      //      }
+      ::memcpy(&nextChunk, chunk.data(), sizeof(nextChunk));
+      ::memcpy(bufferPtr, chunk.data() + 32, readerUsableChunkSize);
+      bufferPtr += readerUsableChunkSize;
     }
   }
   else
   {
     size_t offset = readerChunkSize * m_PointerTableInit + 312ULL;
-    SFS_UTIL_FSEEK(fin, offset, SEEK_SET);
-    if(fread(bufferPtr, 1, readerUsableChunkSize, fin) != readerUsableChunkSize)
+    if(m_Reader->readRaw(offset, readerUsableChunkSize, bufferPtr) != static_cast<int64_t>(readerUsableChunkSize))
     {
       m_IsValid = false;
       return;
     }
   }
-  bufferPtr = buffer.data();
-  m_FilePointerTable.resize(m_ChunkCount);
-  //  size_t maxIndex = buffer.size() / 4;
-  //  if(maxIndex < m_ChunkCount)
-  //  {
-  //    std::cout << "We will walk off the end of the array." << std::endl;
-  //  }
-  //  bool messedUp = false;
+
+  // Collapse the table into runs of chunks that sit one chunk size apart
+  m_ChunkExtents.clear();
+  uint64_t previousChunk = 0;
   for(size_t i = 0; i < m_ChunkCount; i++)
   {
-
-    auto value = static_cast<size_t>(ui32Ptr[i]);
-    m_FilePointerTable[i] = value * static_cast<size_t>(readerChunkSize) + 312ULL;
-    //    if(m_FilePointerTable[i] > 18661284985 && !messedUp)
-    //    {
-    //      std::cout << "===========================" << std::endl;
-    //      messedUp = true;
-    //    }
-    //    if(debug)
-    //    {
-    //      std::cout << "    m_FilePointerTable[" << i << "] = " << m_FilePointerTable[i] << std::endl;
-    //    }
+    auto value = static_cast<uint64_t>(ui32Ptr[i]);
+    if(i == 0 || value != previousChunk + 1)
+    {
+      m_ChunkExtents.push_back({i, value * readerChunkSize + 312ULL});
+    }
+    previousChunk = value;
   }
+  m_ChunkExtents.shrink_to_fit();
 }
 
 // -----------------------------------------------------------------------------
-std::vector<uint8_t> SFSNodeItem::extractFile() const
+size_t SFSNodeItem::getMaxRunLength() const
 {
-  std::vector<uint8_t> data(m_FileSize, 0);
-  if(m_FileSize == 0)
+  const size_t chunkSize = m_Reader->getChunkSize();
+  return std::max<size_t>(1, k_MaxRunBytes / chunkSize);
+}
+
+// -----------------------------------------------------------------------------
+size_t SFSNodeItem::getContiguousRunLength(size_t chunkIndex, size_t maxRunLength) const
+{
+  const size_t extentIndex = findExtent(chunkIndex);
+  const uint64_t endChunk = extentIndex + 1 < m_ChunkExtents.size() ? m_ChunkExtents[extentIndex + 1].firstChunk : static_cast<uint64_t>(m_ChunkCount);
+  return static_cast<size_t>(std::clamp<uint64_t>(endChunk - chunkIndex, 1, std::max<size_t>(maxRunLength, 1)));
+}
+
+// -----------------------------------------------------------------------------
+uint64_t SFSNodeItem::getPayloadSize(size_t chunkIndex, size_t runLength) const
+{
+  const uint64_t usableChunkSize = m_Reader->getUsableChunkSize();
+  const uint64_t start = chunkIndex * usableChunkSize;
+  return std::min(runLength * usableChunkSize, m_FileSize - start);
+}
+
+// -----------------------------------------------------------------------------
+int64_t SFSNodeItem::readWindow(size_t chunkIndex, size_t endChunk, uint8_t* buffer, SFSIoUring* ring, size_t& windowLength) const
+{
+  const uint64_t chunkSize = m_Reader->getChunkSize();
+  const uint64_t usableChunkSize = m_Reader->getUsableChunkSize();
+  const size_t maxWindowLength = std::min(getMaxRunLength(), endChunk - chunkIndex);
+
+  // Split the window into runs of physically consecutive chunks. Each run is read in one go and spans
+  // every header between its payloads, but not the header in front of the first one. Chunk 'c' of the
+  // window therefore lands at 'c * chunkSize' in the buffer.
+  std::vector<SFSIoUring::ReadRequest> requests;
+  windowLength = 0;
+  while(windowLength < maxWindowLength)
   {
-    return data;
+    const size_t first = chunkIndex + windowLength;
+    const size_t runLength = getContiguousRunLength(first, maxWindowLength - windowLength);
+    const uint64_t rawSize = getPayloadSize(first, runLength) + (runLength - 1) * (chunkSize - usableChunkSize);
+    uint8_t* dest = buffer + windowLength * chunkSize;
+    const uint64_t filePos = getChunkPosition(first);
+    if(ring != nullptr)
+    {
+      // Cut long runs into pieces so that the ring has plenty of requests to keep in flight
+      for(uint64_t offset = 0; offset < rawSize; offset += k_IoUringRequestBytes)
+      {
+        requests.push_back({filePos + offset, std::min<uint64_t>(k_IoUringRequestBytes, rawSize - offset), dest + offset});
+      }
+    }
+    else
+    {
+      requests.push_back({filePos, rawSize, dest});
+    }
+    windowLength += runLength;
   }
-  if(m_Directory)
+  const uint64_t payloadSize = getPayloadSize(chunkIndex, windowLength);
+
+  bool readOk = true;
+  if(ring != nullptr && requests.size() > 1)
   {
-    return data;
+    readOk = ring->readAll(m_Reader->getInputHandle(), requests) == 0;
   }
-  const std::string& inputFilePath = m_Reader->getInputFile();
-  FILE* fn = fopen(inputFilePath.c_str(), "rb");
-  if(nullptr == fn)
+  else
   {
-    return data;
+    for(const auto& request : requests)
+    {
+      if(m_Reader->readRaw(request.offset, request.length, request.dest) != static_cast<int64_t>(request.length))
+      {
+        readOk = false;
+        break;
+      }
+    }
+  }
+  if(!readOk)
+  {
+    ::memset(buffer, 0, payloadSize);
+    return -1;
   }
 
-  if(m_ChunkCount == 1)
+  // Squeeze out the 32 byte chunk headers so that the payloads are back to back. Payloads only ever move
+  // towards the front of the buffer so they can be moved in order.
+  for(size_t c = 1; c < windowLength; c++)
+  {
+    uint64_t count = std::min(usableChunkSize, payloadSize - c * usableChunkSize);
+    ::memmove(buffer + c * usableChunkSize, buffer + c * chunkSize, count);
+  }
+  return static_cast<int64_t>(payloadSize);
+}
+
+// -----------------------------------------------------------------------------
+void SFSNodeItem::prefetchChunks(size_t firstChunk, size_t endChunk) const
+{
+  const uint64_t headerSize = m_Reader->getChunkSize() - m_Reader->getUsableChunkSize();
+  for(size_t c = firstChunk; c < endChunk;)
   {
-    SFS_UTIL_FSEEK(fn, m_FilePointerTable[0], SEEK_SET);
-    if(fread(data.data(), 1, m_FileSize, fn) != m_FileSize)
+    const size_t runLength = getContiguousRunLength(c, endChunk - c);
+    m_Reader->adviseWillNeed(getChunkPosition(c), getPayloadSize(c, runLength) + (runLength - 1) * headerSize);
+    c += runLength;
+  }
+}
+
+// -----------------------------------------------------------------------------
+void SFSNodeItem::prefetch(uint64_t offset, uint64_t length) const
+{
+  if(m_Directory || length == 0 || m_Reader == nullptr || m_Reader->getPrefetchWindow() == 0)
+  {
+    return;
+  }
+  uint64_t storedStart = offset;
+  uint64_t storedEnd = offset + length;
+  if(isCompressed())
+  {
+    loadCompressedBlocks();
+    if(m_CompressedBlocks.empty() || offset >= m_UncompressedSize)
     {
-      return data;
+      return;
     }
+    const CompressedBlock& first = m_CompressedBlocks[findCompressedBlock(offset)];
+    const CompressedBlock& last = m_CompressedBlocks[findCompressedBlock(std::min(storedEnd, m_UncompressedSize) - 1)];
+    storedStart = first.storedOffset;
+    storedEnd = last.storedOffset + last.storedSize;
   }
-  else
+  storedEnd = std::min(storedEnd, m_FileSize);
+  loadFilePointerTable();
+  if(!m_IsValid || storedStart >= storedEnd)
   {
-    size_t dataSize = 0;
-    size_t chunkSize = static_cast<size_t>(m_Reader->getUsableChunkSize());
-    uint8_t* destPtr = data.data();
-    for(size_t i = 0; i < m_ChunkCount; i++)
+    return;
+  }
+  const uint64_t usableChunkSize = m_Reader->getUsableChunkSize();
+  prefetchChunks(storedStart / usableChunkSize, (storedEnd + usableChunkSize - 1) / usableChunkSize);
+}
+
+// -----------------------------------------------------------------------------
+uint64_t SFSNodeItem::prefetchAhead(uint64_t position, uint64_t prefetchedEnd) const
+{
+  const uint64_t window = m_Reader == nullptr ? 0 : m_Reader->getPrefetchWindow();
+  if(window == 0)
+  {
+    return prefetchedEnd;
+  }
+  if(prefetchedEnd < position)
+  {
+    prefetchedEnd = position;
+  }
+  const uint64_t fileSize = getUncompressedSize();
+  if(prefetchedEnd >= fileSize || prefetchedEnd - position >= window / 2)
+  {
+    return prefetchedEnd;
+  }
+  const uint64_t end = std::min(fileSize, position + window);
+  prefetch(prefetchedEnd, end - prefetchedEnd);
+  return end;
+}
+
+// -----------------------------------------------------------------------------
+int64_t SFSNodeItem::readStoredData(uint64_t offset, uint64_t length, uint8_t* dest) const
+{
+  if(m_Directory || offset >= m_FileSize)
+  {
+    return 0;
+  }
+  length = std::min(length, m_FileSize - offset);
+  loadFilePointerTable();
+  if(!m_IsValid)
+  {
+    return -1;
+  }
+
+  const uint64_t chunkSize = m_Reader->getChunkSize();
+  const uint64_t usableChunkSize = m_Reader->getUsableChunkSize();
+  const uint64_t headerSize = chunkSize - usableChunkSize;
+  const bool memoryMapped = m_Reader->isMemoryMapped();
+  const size_t maxRunLength = getMaxRunLength();
+  std::vector<uint8_t> buffer;
+
+  uint64_t copied = 0;
+  while(copied < length)
+  {
+    const uint64_t position = offset + copied;
+    const size_t chunkIndex = position / usableChunkSize;
+    const uint64_t chunkOffset = position % usableChunkSize;
+    const uint64_t remaining = length - copied;
+    if(memoryMapped)
+    {
+      std::span<const uint8_t> chunk = getChunkView(chunkIndex);
+      if(chunkOffset >= chunk.size())
+      {
+        return -1;
+      }
+      uint64_t count = std::min<uint64_t>(chunk.size() - chunkOffset, remaining);
+      ::memcpy(dest + copied, chunk.data() + chunkOffset, count);
+      copied += count;
+      continue;
+    }
+
+    // Only look as far ahead as the chunks that the remaining bytes touch
+    const size_t chunksNeeded = static_cast<size_t>((chunkOffset + remaining + usableChunkSize - 1) / usableChunkSize);
+    const size_t runLength = getContiguousRunLength(chunkIndex, std::min(chunksNeeded, maxRunLength));
+    const uint64_t count = std::min<uint64_t>(runLength * usableChunkSize - chunkOffset, remaining);
+    const uint64_t filePos = getChunkPosition(chunkIndex) + chunkOffset;
+    if(runLength == 1)
+    {
+      if(m_Reader->readRaw(filePos, count, dest + copied) != static_cast<int64_t>(count))
+      {
+        return -1;
+      }
+    }
+    else
     {
-      SFS_UTIL_FSEEK(fn, m_FilePointerTable[i], SEEK_SET);
-      if(fread(destPtr, 1, chunkSize, fn) != chunkSize)
+      // One read for the whole run, then drop the chunk headers between the payloads.
+      const uint64_t rawSize = count + (runLength - 1) * headerSize;
+      buffer.resize(rawSize);
+      if(m_Reader->readRaw(filePos, rawSize, buffer.data()) != static_cast<int64_t>(rawSize))
       {
-        data.assign(m_FileSize, 0);
-        return data;
+        return -1;
       }
-      destPtr += chunkSize;
-      dataSize += chunkSize;
-      if(m_FileSize - dataSize < chunkSize)
+      uint64_t source = 0;
+      uint64_t written = 0;
+      uint64_t piece = usableChunkSize - chunkOffset;
+      while(written < count)
       {
-        chunkSize = m_FileSize - dataSize;
+        piece = std::min(piece, count - written);
+        ::memcpy(dest + copied + written, buffer.data() + source, piece);
+        written += piece;
+        source += piece + headerSize;
+        piece = usableChunkSize;
       }
     }
+    copied += count;
   }
-  fclose(fn);
-  return data;
+  return static_cast<int64_t>(copied);
 }
 
 // -----------------------------------------------------------------------------
-int32_t SFSNodeItem::writeFile(const std::string& outputfile) const
+int64_t SFSNodeItem::readData(uint64_t offset, uint64_t length, uint8_t* dest) const
 {
-  if(m_FileSize == 0)
+  if(!isCompressed())
+  {
+    return readStoredData(offset, length, dest);
+  }
+  loadCompressedBlocks();
+  if(m_CompressedBlocks.empty())
   {
     return -1;
   }
-  if(m_Directory)
+  if(offset >= m_UncompressedSize)
   {
-    return -2;
+    return 0;
   }
+  length = std::min(length, m_UncompressedSize - offset);
 
-  FILE* out = fopen(outputfile.c_str(), "wb");
-  if(out == nullptr)
+  std::vector<uint8_t> blockBuffer;
+  uint64_t copied = 0;
+  for(size_t blockIndex = findCompressedBlock(offset); copied < length && blockIndex < m_CompressedBlocks.size(); blockIndex++)
   {
-    return -3;
+    const CompressedBlock& block = m_CompressedBlocks[blockIndex];
+    const uint64_t blockOffset = offset + copied - block.offset;
+    const uint64_t count = std::min<uint64_t>(block.size - blockOffset, length - copied);
+    if(count == block.size)
+    {
+      // The whole block is wanted so it can be inflated straight into the destination
+      if(inflateBlock(blockIndex, dest + copied) != static_cast<int64_t>(block.size))
+      {
+        return -1;
+      }
+    }
+    else
+    {
+      blockBuffer.resize(block.size);
+      if(inflateBlock(blockIndex, blockBuffer.data()) != static_cast<int64_t>(block.size))
+      {
+        return -1;
+      }
+      ::memcpy(dest + copied, blockBuffer.data() + blockOffset, count);
+    }
+    copied += count;
   }
+  return static_cast<int64_t>(copied);
+}
+
+// -----------------------------------------------------------------------------
+bool SFSNodeItem::isCompressed() const
+{
+  return m_Reader != nullptr && m_Reader->isCompressed() && !m_Directory && m_FileSize > 0;
+}
 
-  const std::string& inputFilePath = m_Reader->getInputFile();
-  FILE* fn = fopen(inputFilePath.c_str(), "rb");
-  if(nullptr == fn)
+// -----------------------------------------------------------------------------
+uint64_t SFSNodeItem::getUncompressedSize() const
+{
+  if(!isCompressed())
   {
-    fclose(out);
-    return -4;
+    return m_Directory ? 0 : m_FileSize;
   }
-  if(m_ChunkCount == 1)
+  loadCompressedBlocks();
+  return m_UncompressedSize;
+}
+
+// -----------------------------------------------------------------------------
+const std::vector<SFSNodeItem::CompressedBlock>& SFSNodeItem::getCompressedBlocks() const
+{
+  if(isCompressed())
   {
-    std::vector<uint8_t> data(m_FileSize, 0);
-    SFS_UTIL_FSEEK(fn, m_FilePointerTable[0], SEEK_SET);
-    if(fread(data.data(), 1, m_FileSize, fn) != m_FileSize)
+    loadCompressedBlocks();
+  }
+  return m_CompressedBlocks;
+}
+
+// -----------------------------------------------------------------------------
+size_t SFSNodeItem::findCompressedBlock(uint64_t offset) const
+{
+  auto iter = std::upper_bound(m_CompressedBlocks.begin(), m_CompressedBlocks.end(), offset, [](uint64_t position, const CompressedBlock& block) { return position < block.offset; });
+  return iter == m_CompressedBlocks.begin() ? 0 : static_cast<size_t>(iter - m_CompressedBlocks.begin()) - 1;
+}
+
+// -----------------------------------------------------------------------------
+void SFSNodeItem::loadCompressedBlocks() const
+{
+  std::call_once(m_CompressedBlocksLoaded, [this]() { generateCompressedBlocks(); });
+}
+
+// -----------------------------------------------------------------------------
+void SFSNodeItem::generateCompressedBlocks() const
+{
+  // Member header: signature, nominal uncompressed size of a block, unknown, number of blocks. The total
+  // uncompressed size is only known once the block headers have been walked.
+  std::array<uint32_t, 4> header = {0, 0, 0, 0};
+  if(readStoredData(0, sizeof(header), reinterpret_cast<uint8_t*>(header.data())) != static_cast<int64_t>(sizeof(header)) || header[0] != k_CompressedSignature)
+  {
+    std::cout << "SFSNodeItem: '" << m_FileName << "' does not start with a compressed data header" << std::endl;
+    return;
+  }
+  const uint32_t blockCount = header[3];
+  std::vector<CompressedBlock> blocks;
+  blocks.reserve(std::min<uint64_t>(blockCount, m_FileSize / k_CompressedBlockHeaderSize));
+
+  // Every block is a header (compressed size, uncompressed size, unknown, compressed size including the header)
+  // followed by a zlib stream
+  uint64_t storedOffset = k_FirstCompressedBlockOffset;
+  uint64_t offset = 0;
+  for(uint32_t b = 0; b < blockCount; b++)
+  {
+    std::array<uint32_t, 4> blockHeader = {0, 0, 0, 0};
+    if(readStoredData(storedOffset, k_CompressedBlockHeaderSize, reinterpret_cast<uint8_t*>(blockHeader.data())) != static_cast<int64_t>(k_CompressedBlockHeaderSize))
+    {
+      std::cout << "SFSNodeItem: '" << m_FileName << "' compressed block " << b << " is truncated" << std::endl;
+      return;
+    }
+    storedOffset += k_CompressedBlockHeaderSize;
+    if(storedOffset + blockHeader[0] > m_FileSize)
     {
-      fclose(out);
-      return -5;
+      std::cout << "SFSNodeItem: '" << m_FileName << "' compressed block " << b << " is truncated" << std::endl;
+      return;
     }
-    fwrite(data.data(), m_FileSize, 1, out);
-    std::cout << m_FileName << std::endl;
+    blocks.push_back({storedOffset, blockHeader[0], offset, blockHeader[1]});
+    storedOffset += blockHeader[0];
+    offset += blockHeader[1];
   }
-  else
+  m_CompressedBlocks = std::move(blocks);
+  m_UncompressedSize = offset;
+}
+
+// -----------------------------------------------------------------------------
+int64_t SFSNodeItem::inflateBlock(size_t blockIndex, uint8_t* dest) const
+{
+  loadCompressedBlocks();
+  if(blockIndex >= m_CompressedBlocks.size())
+  {
+    return -1;
+  }
+  const CompressedBlock& block = m_CompressedBlocks[blockIndex];
+  std::vector<uint8_t> compressed(block.storedSize);
+  if(readStoredData(block.storedOffset, block.storedSize, compressed.data()) != static_cast<int64_t>(block.storedSize))
+  {
+    return -1;
+  }
+  uLongf inflatedSize = block.size;
+  if(::uncompress(dest, &inflatedSize, compressed.data(), block.storedSize) != Z_OK || inflatedSize != block.size)
+  {
+    return -1;
+  }
+  return static_cast<int64_t>(inflatedSize);
+}
+
+// -----------------------------------------------------------------------------
+int32_t SFSNodeItem::getChunkCount() const
+{
+  return m_ChunkCount;
+}
+
+// -----------------------------------------------------------------------------
+std::span<const uint8_t> SFSNodeItem::getChunkView(size_t chunkIndex) const
+{
+  const uint8_t* mappedData = m_Reader == nullptr ? nullptr : m_Reader->getMappedData();
+  if(mappedData == nullptr)
+  {
+    return {};
+  }
+  loadFilePointerTable();
+  if(!m_IsValid || chunkIndex >= static_cast<size_t>(m_ChunkCount))
+  {
+    return {};
+  }
+  uint64_t usableChunkSize = m_Reader->getUsableChunkSize();
+  uint64_t length = std::min(usableChunkSize, m_FileSize - chunkIndex * usableChunkSize);
+  uint64_t filePointer = getChunkPosition(chunkIndex);
+  uint64_t mappedSize = m_Reader->getMappedSize();
+  if(filePointer >= mappedSize)
+  {
+    return {};
+  }
+  length = std::min(length, mappedSize - filePointer);
+  return {mappedData + filePointer, static_cast<size_t>(length)};
+}
+
+// -----------------------------------------------------------------------------
+std::vector<uint8_t> SFSNodeItem::extractFile() const
+{
+  const uint64_t fileSize = getUncompressedSize();
+  std::vector<uint8_t> data(fileSize, 0);
+  if(fileSize == 0)
+  {
+    return data;
+  }
+  if(m_Directory)
+  {
+    return data;
+  }
+  if(readData(0, fileSize, data.data()) != static_cast<int64_t>(fileSize))
+  {
+    data.assign(fileSize, 0);
+  }
+  return data;
+}
+
+// -----------------------------------------------------------------------------
+int32_t SFSNodeItem::copyChunkRange(size_t firstChunk, size_t endChunk, intptr_t outHandle, SFSProgressReporter& progress) const
+{
+  const uint64_t usableChunkSize = m_Reader->getUsableChunkSize();
+
+  // Keeps the kernel reading the chunks ahead of the ones being copied
+  uint64_t prefetchedEnd = 0;
+
+  if(m_Reader->isMemoryMapped())
   {
-    uint64_t dataSize = 0;
-    uint64_t chunkSize = static_cast<uint64_t>(m_Reader->getUsableChunkSize());
-    std::vector<uint8_t> data(chunkSize, 0);
-    uint8_t* destPtr = data.data();
+    // Write each chunk straight out of the mapping. No intermediate buffer is needed.
+    for(size_t i = firstChunk; i < endChunk; i++)
+    {
+      if(progress.isCanceled())
+      {
+        return SFSProgressObserver::k_CanceledError;
+      }
+      prefetchedEnd = prefetchAhead(i * usableChunkSize, prefetchedEnd);
+      std::span<const uint8_t> chunk = getChunkView(i);
+      if(chunk.empty())
+      {
+        std::cout << "Not Enough Bytes Mapped: " << getChunkPosition(i) << std::endl;
+        return -5;
+      }
+      if(!writeOutput(outHandle, i * usableChunkSize, chunk.size(), chunk.data()))
+      {
+        return -6;
+      }
+      progress.add(chunk.size());
+    }
+    return 0;
+  }
 
-    float progress = 0.0f;
-    float currentProgress = 0.0f;
+  // copy_file_range() and io_uring would read through the page cache
+  const bool directIO = m_Reader->getUseDirectIO();
 
-    // std::cout << m_FileName << std::endl;
-    for(size_t i = 0; i < m_ChunkCount; i++)
+  // Fragmented members are read with many requests in flight when io_uring is available
+  std::unique_ptr<SFSIoUring> ring;
+  if(m_Reader->getUseIoUring() && !directIO && endChunk - firstChunk > 1)
+  {
+    ring = std::make_unique<SFSIoUring>();
+    if(!ring->isValid())
+    {
+      ring.reset();
+    }
+  }
+
+  // copy_file_range() is one blocking call per chunk payload, so it is only used for large chunks and
+  // never in place of io_uring, which keeps many reads in flight
+  if(m_Reader->getUseCopyFileRange() && !directIO && ring == nullptr && usableChunkSize >= k_MinCopyRangeBytes)
+  {
+    // Let the kernel copy every chunk payload straight into place. The headers between the payloads of
+    // consecutive chunks are skipped by copying each payload on its own.
+    uint64_t pendingBytes = 0;
+    size_t i = firstChunk;
+    for(; i < endChunk; i++)
     {
-      currentProgress = static_cast<float>(i) / static_cast<float>(m_ChunkCount);
-      if(currentProgress > progress)
+      prefetchedEnd = prefetchAhead(i * usableChunkSize, prefetchedEnd);
+      const uint64_t length = getPayloadSize(i, 1);
+      if(SFSUtils::copyRange(m_Reader->getInputHandle(), getChunkPosition(i), outHandle, i * usableChunkSize, length) != static_cast<int64_t>(length))
       {
-        progress = progress + 0.01f;
-        std::cout << m_FileName << " " << m_FileSize << " [" << static_cast<int>(currentProgress * 100.0f) << "%]\r";
-        std::cout.flush();
+        break;
       }
-      size_t filePointer = m_FilePointerTable[i];
-      SFS_UTIL_FSEEK(fn, filePointer, SEEK_SET);
-      size_t numBytesRead = fread(destPtr, 1, chunkSize, fn);
-      if(numBytesRead != chunkSize)
+      pendingBytes += length;
+      if(pendingBytes >= k_MaxRunBytes)
       {
-        std::cout << "Not Enough Bytes Read: " << m_FilePointerTable[i] << " Needed " << chunkSize << " Got " << numBytesRead << std::endl;
+        progress.add(pendingBytes);
+        pendingBytes = 0;
+        if(progress.isCanceled())
+        {
+          return SFSProgressObserver::k_CanceledError;
+        }
       }
-      fwrite(destPtr, chunkSize, 1, out);
-      dataSize += chunkSize;
-      if(m_FileSize - dataSize < chunkSize)
+    }
+    if(pendingBytes > 0)
+    {
+      progress.add(pendingBytes);
+    }
+    if(i == endChunk)
+    {
+      return 0;
+    }
+    // The kernel can not copy between these files. Copy the rest through user space.
+    firstChunk = i;
+  }
+
+  // Fetch the chunks a window at a time. Two buffers are used so that the next window is read while
+  // the previous one is still being written.
+  const size_t maxWindowLength = getMaxRunLength();
+  std::array<std::vector<uint8_t>, 2> buffers;
+  size_t current = 0;
+  std::future<bool> pendingWrite;
+
+  auto writeRun = [this, outHandle, &progress](uint64_t fileOffset, const std::vector<uint8_t>& data, uint64_t numBytes) {
+    if(!writeOutput(outHandle, fileOffset, numBytes, data.data()))
+    {
+      return false;
+    }
+    progress.add(numBytes);
+    return true;
+  };
+
+  for(size_t i = firstChunk; i < endChunk;)
+  {
+    if(progress.isCanceled())
+    {
+      // The pending write still uses the other buffer
+      if(pendingWrite.valid())
       {
-        chunkSize = m_FileSize - dataSize;
+        pendingWrite.get();
       }
+      return SFSProgressObserver::k_CanceledError;
     }
-    std::cout << std::endl;
+    // The window about to be read is fetched right away, so the prefetching starts after it
+    prefetchedEnd = prefetchAhead(std::min(i + maxWindowLength, endChunk) * usableChunkSize, prefetchedEnd);
+    std::vector<uint8_t>& data = buffers[current];
+    data.resize(std::max<size_t>(data.size(), std::min(maxWindowLength, endChunk - i) * m_Reader->getChunkSize()));
+    size_t windowLength = 0;
+    int64_t numBytes = readWindow(i, endChunk, data.data(), ring.get(), windowLength);
+    if(numBytes < 0)
+    {
+      std::cout << "Not Enough Bytes Read: " << getChunkPosition(i) << " Needed " << windowLength << " chunks" << std::endl;
+      numBytes = static_cast<int64_t>(getPayloadSize(i, windowLength));
+    }
+
+    if(pendingWrite.valid() && !pendingWrite.get())
+    {
+      return -6;
+    }
+    const uint64_t fileOffset = i * usableChunkSize;
+    i += windowLength;
+    if(i >= endChunk)
+    {
+      // Nothing left to overlap the last write with
+      return writeRun(fileOffset, data, numBytes) ? 0 : -6;
+    }
+    pendingWrite = std::async(std::launch::async, writeRun, fileOffset, std::cref(data), static_cast<uint64_t>(numBytes));
+    current ^= 1;
   }
 
-  fclose(out);
-  fclose(fn);
+  if(pendingWrite.valid() && !pendingWrite.get())
+  {
+    return -6;
+  }
   return 0;
 }
 
 // -----------------------------------------------------------------------------
-void SFSNodeItem::setParentNode(SFSNodeItem* parent)
+int32_t SFSNodeItem::writeFile(const std::string& outputfile, bool showProgress, size_t threadCount) const
 {
-  m_ParentObject = parent;
+  SFSConsoleProgress console;
+  SFSProgressObserver* observer = m_Reader == nullptr ? nullptr : m_Reader->getProgressObserver();
+  if(observer == nullptr && showProgress)
+  {
+    observer = &console;
+  }
+  SFSProgressReporter progress(observer, std::string(m_FileName), getUncompressedSize());
+  int32_t err = writeFile(outputfile, progress, threadCount);
+  progress.finish();
+  return err;
 }
 
 // -----------------------------------------------------------------------------
-SFSNodeItem* SFSNodeItem::getParentNode()
+int32_t SFSNodeItem::writeFile(const std::string& outputfile, SFSProgressReporter& progress, size_t threadCount) const
 {
-  return m_ParentObject;
+  if(m_FileSize == 0)
+  {
+    return -1;
+  }
+  if(m_Directory)
+  {
+    return -2;
+  }
+  loadFilePointerTable();
+  if(!m_IsValid)
+  {
+    return -4;
+  }
+  const bool compressed = isCompressed();
+  if(compressed && getCompressedBlocks().empty())
+  {
+    return -4;
+  }
+  const uint64_t outputSize = getUncompressedSize();
+
+  SFSUtils::FileHandle out = SFSUtils::openFileForWriting(outputfile);
+  if(out == SFSUtils::k_InvalidFileHandle)
+  {
+    return -3;
+  }
+  // Pre-size the output so that every range can be written in place
+  if(!SFSUtils::resizeFile(out, outputSize))
+  {
+    SFSUtils::closeFile(out);
+    return -3;
+  }
+
+  // Large files are split into ranges of whole chunks that are copied concurrently
+  const size_t rangeCount = static_cast<size_t>(std::clamp<uint64_t>(m_FileSize / k_MinRangeBytes, 1, std::max<size_t>(threadCount, 1)));
+  const size_t chunkCount = static_cast<size_t>(m_ChunkCount);
+  const size_t chunksPerRange = (chunkCount + rangeCount - 1) / rangeCount;
+
+  int32_t err = 0;
+  if(compressed)
+  {
+    err = inflateBlocks(out, threadCount, progress);
+  }
+  else if(rangeCount == 1)
+  {
+    err = copyChunkRange(0, chunkCount, out, progress);
+  }
+  else
+  {
+    std::vector<std::future<int32_t>> ranges;
+    for(size_t firstChunk = 0; firstChunk < chunkCount; firstChunk += chunksPerRange)
+    {
+      size_t endChunk = std::min(firstChunk + chunksPerRange, chunkCount);
+      ranges.push_back(std::async(std::launch::async, [this, firstChunk, endChunk, out, &progress]() { return copyChunkRange(firstChunk, endChunk, out, progress); }));
+    }
+    for(auto& range : ranges)
+    {
+      int32_t rangeErr = range.get();
+      if(rangeErr < 0)
+      {
+        err = rangeErr;
+      }
+    }
+  }
+
+  SFSUtils::closeFile(out);
+  return err;
 }
 
 // -----------------------------------------------------------------------------
-void SFSNodeItem::addChildNode(const SFSNodeItem::Pointer& child)
+int32_t SFSNodeItem::inflateBlocks(intptr_t outHandle, size_t threadCount, SFSProgressReporter& progress) const
 {
-  m_Children[child->getFileName()] = child;
-  child->setParentNode(this);
+  std::atomic<int32_t> err = 0;
+  std::mutex prefetchMutex;
+  uint64_t prefetchedEnd = 0;
+  auto inflateToOutput = [this, outHandle, &progress, &err, &prefetchMutex, &prefetchedEnd](size_t blockIndex) {
+    if(err != 0)
+    {
+      return;
+    }
+    if(progress.isCanceled())
+    {
+      err = SFSProgressObserver::k_CanceledError;
+      return;
+    }
+    const CompressedBlock& block = m_CompressedBlocks[blockIndex];
+    {
+      // The blocks are picked up roughly in order, so keep the blocks after this one on their way in
+      std::lock_guard<std::mutex> lock(prefetchMutex);
+      prefetchedEnd = prefetchAhead(block.offset + block.size, prefetchedEnd);
+    }
+    std::vector<uint8_t> buffer(block.size);
+    if(inflateBlock(blockIndex, buffer.data()) != static_cast<int64_t>(block.size))
+    {
+      std::cout << "SFSNodeItem: Could not inflate block " << blockIndex << " of '" << m_FileName << "'" << std::endl;
+      err = -5;
+      return;
+    }
+    if(!writeOutput(outHandle, block.offset, block.size, buffer.data()))
+    {
+      err = -6;
+      return;
+    }
+    progress.add(block.size);
+  };
+
+  // Every block is an independent zlib stream with a known place in the output, so blocks can be
+  // inflated and written in any order
+  const size_t workerCount = std::min(std::max<size_t>(threadCount, 1), m_CompressedBlocks.size());
+  if(workerCount <= 1)
+  {
+    for(size_t b = 0; b < m_CompressedBlocks.size() && err == 0; b++)
+    {
+      inflateToOutput(b);
+    }
+  }
+  else
+  {
+    ThreadPool pool(workerCount);
+    for(size_t b = 0; b < m_CompressedBlocks.size(); b++)
+    {
+      pool.enqueue([&inflateToOutput, b]() { inflateToOutput(b); });
+    }
+    pool.waitForAll();
+  }
+  return err;
 }
 
 // -----------------------------------------------------------------------------
-void SFSNodeItem::removeChildNode(const std::string& name)
+bool SFSNodeItem::writeOutput(intptr_t outHandle, uint64_t offset, uint64_t length, const uint8_t* data) const
 {
-  if(m_Children.find(name) != m_Children.end())
+  if(SFSUtils::writeAt(outHandle, offset, length, data) != static_cast<int64_t>(length))
   {
-    SFSNodeItem::Pointer item = m_Children[name];
-    item->setParentNode(nullptr);
-    m_Children.erase(name);
+    return false;
   }
+  if(m_Reader->getUseDirectIO())
+  {
+    SFSUtils::dropCachedRange(outHandle, offset, length);
+  }
+  return true;
 }
 
 // -----------------------------------------------------------------------------
-size_t SFSNodeItem::childCount()
+void SFSNodeItem::setParentNode(SFSNodeItem* parent)
 {
-  return m_Children.size();
+  m_ParentObject = parent;
 }
 
 // -----------------------------------------------------------------------------
-void SFSNodeItem::clearChildren()
+SFSNodeItem* SFSNodeItem::getParentNode() const
 {
+  return m_ParentObject;
+}
 
-  for(const auto& child : m_Children)
-  {
-    child.second->setParentNode(nullptr);
-  }
+// -----------------------------------------------------------------------------
+void SFSNodeItem::setChildren(std::span<SFSNodeItem* const> children)
+{
+  m_Children = children;
+}
 
-  m_Children.clear();
+// -----------------------------------------------------------------------------
+size_t SFSNodeItem::childCount() const
+{
+  return m_Children.size();
 }
 
 // -----------------------------------------------------------------------------
-SFSNodeItem::Pointer SFSNodeItem::child(const std::string& name)
+SFSNodeItem* SFSNodeItem::child(std::string_view name) const
 {
-  if(m_Children.find(name) != m_Children.end())
+  for(SFSNodeItem* item : m_Children)
   {
-    return m_Children[name];
+    if(item->getFileNameView() == name)
+    {
+      return item;
+    }
   }
-  return SFSNodeItem::Pointer(nullptr);
+  return nullptr;
 }
 
 // -----------------------------------------------------------------------------
-std::map<std::string, SFSNodeItem::Pointer>& SFSNodeItem::children()
+std::span<SFSNodeItem* const> SFSNodeItem::children() const
 {
   return m_Children;
 }
@@ -450,12 +1062,19 @@ bool SFSNodeItem::isDirectory() const
 
 // -----------------------------------------------------------------------------
 std::string SFSNodeItem::getFileName() const
+{
+  return std::string(m_FileName);
+}
+
+// -----------------------------------------------------------------------------
+std::string_view SFSNodeItem::getFileNameView() const
 {
   return m_FileName;
 }
 
 bool SFSNodeItem::getIsValid() const
 {
+  loadFilePointerTable();
   return m_IsValid;
 }
 
@@ -483,16 +1102,16 @@ void SFSNodeItem::printTree(std::ostream& out, int32_t level) const
 {
   std::string indent(level, ' ');
   out << indent << m_FileName << std::endl;
-  for(const auto& item : m_Children)
+  for(const SFSNodeItem* item : m_Children)
   {
-    if(item.second->isDirectory())
+    if(item->isDirectory())
     {
-      item.second->printTree(out, level + 2);
+      item->printTree(out, level + 2);
     }
     else
     {
       indent = std::string(level + 4, ' ');
-      out << indent << item.second->getFileName() << ": " << item.second->getFileSize() << std::endl;
+      out << indent << item->getFileName() << ": " << item->getFileSize() << std::endl;
     }
   }
 }
@@ -19,13 +19,18 @@
 #pragma once
 
 #include <cstdio>
+#include <cstdint>
 #include <array>
 #include <string>
 #include <vector>
-#include <map>
 #include <memory>
+#include <mutex>
+#include <span>
+#include <string_view>
 
+class SFSProgressReporter;
 class SFSReader;
+class SFSIoUring;
 
 /**
  * @brief The SFSNodeItem class holds all the information for an individual file within the SFS file
@@ -34,8 +39,33 @@ class SFSNodeItem
 {
 
 public:
+  /**
+   * @brief Files larger than this are split into ranges of this size that are copied concurrently by writeFile()
+   */
+  static constexpr uint64_t k_MinRangeBytes = 64 * 1024 * 1024;
+
+  /**
+   * @brief A run of chunks of a file that sit one chunk size apart in the container. The run ends where the
+   * next extent starts, or at the last chunk of the file.
+   */
+  struct ChunkExtent
+  {
+    uint64_t firstChunk = 0; // Index of the first chunk of the run within the file
+    uint64_t filePos = 0;    // Absolute container position of the payload of the first chunk
+  };
+
+  /**
+   * @brief One independently inflatable zlib stream of a file in a compressed container
+   */
+  struct CompressedBlock
+  {
+    uint64_t storedOffset = 0; // Offset of the zlib stream within the stored file data
+    uint32_t storedSize = 0;   // Number of compressed bytes
+    uint64_t offset = 0;       // Offset of the inflated bytes within the file
+    uint32_t size = 0;         // Number of inflated bytes
+  };
+
   SFSNodeItem() = default;
-  explicit SFSNodeItem(const uint8_t* raw_string, FILE* fin, SFSReader* reader);
   ~SFSNodeItem();
 
   /**
@@ -44,10 +74,27 @@ public:
   using Pointer = std::shared_ptr<SFSNodeItem>;
 
 
-  SFSNodeItem(const SFSNodeItem&) = default; // Copy Constructor
-  SFSNodeItem(SFSNodeItem&&) = default;      // Move Constructor
-  SFSNodeItem& operator=(const SFSNodeItem&) = default; // Copy Assignment Not Implemented
-  SFSNodeItem& operator=(SFSNodeItem&&) = default;      // Move Assignment Not Implemented
+  SFSNodeItem(const SFSNodeItem&) = delete;            // Copy Constructor Not Implemented
+  SFSNodeItem(SFSNodeItem&&) = delete;                 // Move Constructor Not Implemented
+  SFSNodeItem& operator=(const SFSNodeItem&) = delete; // Copy Assignment Not Implemented
+  SFSNodeItem& operator=(SFSNodeItem&&) = delete;      // Move Assignment Not Implemented
+
+  /**
+   * @brief setTreeItem Fills in the node from its raw 512 byte tree item. The names of the node point into
+   * 'raw_string' so it must outlive the node. The pointer table of a file is not read until the first time
+   * the file's data is accessed.
+   * @param raw_string
+   * @param reader
+   */
+  void setTreeItem(const uint8_t* raw_string, SFSReader* reader);
+
+  /**
+   * @brief setChunkExtents Hands the node an already known pointer table, for example one loaded from an
+   * index file, instead of walking the pointer table chunks in the container. Must be called before the
+   * pointer table is first used.
+   * @param chunkExtents Runs of consecutive chunks, ordered by their first chunk and starting at chunk 0
+   */
+  void setChunkExtents(std::vector<ChunkExtent> chunkExtents);
 
   /**
    * @brief getPointerTableInit
@@ -56,11 +103,47 @@ public:
   int32_t getPointerTableInit() const;
 
   /**
-   * @brief getFileSize
+   * @brief getFileSize Returns the number of bytes stored in the container. For a compressed file this is
+   * the compressed size, see getUncompressedSize().
    * @return
    */
   uint64_t getFileSize() const;
 
+  /**
+   * @brief getUncompressedSize Returns the size of the file once it is inflated. This is the same as
+   * getFileSize() unless the file is compressed.
+   * @return
+   */
+  uint64_t getUncompressedSize() const;
+
+  /**
+   * @brief isCompressed Returns true if the file is stored as zlib compressed blocks
+   * @return
+   */
+  bool isCompressed() const;
+
+  /**
+   * @brief getCompressedBlocks Returns the block layout of a compressed file. The layout is read from the
+   * container on first use. Empty if the file is not compressed or the layout could not be read.
+   * @return
+   */
+  const std::vector<CompressedBlock>& getCompressedBlocks() const;
+
+  /**
+   * @brief findCompressedBlock Returns the index of the compressed block that holds the byte at 'offset'
+   * @param offset Offset within the inflated file
+   * @return
+   */
+  size_t findCompressedBlock(uint64_t offset) const;
+
+  /**
+   * @brief inflateBlock Reads and inflates a single compressed block. Thread safe.
+   * @param blockIndex
+   * @param dest Receives the inflated bytes. Must hold at least the block's size.
+   * @return The number of inflated bytes or -1 on error
+   */
+  int64_t inflateBlock(size_t blockIndex, uint8_t* dest) const;
+
   /**
    * @brief getFileCreationTime
    * @return
@@ -103,20 +186,118 @@ public:
    */
   std::string getFileName() const;
 
+  /**
+   * @brief getFileNameView Returns the file name without copying it out of the raw tree item
+   * @return
+   */
+  std::string_view getFileNameView() const;
+
+  /**
+   * @brief getIsValid Returns false if the pointer table of the file could not be read. This reads the
+   * pointer table if that has not happened yet.
+   * @return
+   */
   bool getIsValid() const;
 
+  /**
+   * @brief getChunkExtents Returns the pointer table of the file as runs of physically consecutive chunks.
+   * The table is read from the container on first use.
+   * @return
+   */
+  const std::vector<ChunkExtent>& getChunkExtents() const;
+
+  /**
+   * @brief getChunkPosition Returns the absolute container position of the payload of the chunk at the given
+   * index. This is a binary search over the extents.
+   * @param chunkIndex
+   * @return
+   */
+  uint64_t getChunkPosition(size_t chunkIndex) const;
+
+  /**
+   * @brief getChunkCount Returns the number of SFS chunks the file data is spread over
+   * @return
+   */
+  int32_t getChunkCount() const;
+
+  /**
+   * @brief getChunkView Returns a view of the payload bytes of the chunk at the given index
+   * pointing straight into the memory mapped container. The last chunk is truncated to the
+   * file size. An empty span is returned if the reader is not memory mapped or the index is
+   * out of range.
+   * @param chunkIndex
+   * @return
+   */
+  std::span<const uint8_t> getChunkView(size_t chunkIndex) const;
+
   /**
    * @brief extractFile
    * @return
    */
   std::vector<uint8_t> extractFile() const;
 
+  /**
+   * @brief readData Reads 'length' bytes of this file starting at 'offset'. Compressed files are inflated,
+   * so 'offset' and 'length' always refer to the uncompressed file. Safe to call from multiple threads at once.
+   * @param offset
+   * @param length
+   * @param dest
+   * @return The number of bytes read or -1 on error
+   */
+  int64_t readData(uint64_t offset, uint64_t length, uint8_t* dest) const;
+
+  /**
+   * @brief prefetch Asks the kernel to start reading the given range of the file into memory in the background,
+   * following the pointer table of the file. For a compressed file the range refers to the uncompressed file
+   * and the blocks that hold it are prefetched. Does nothing when the reader's prefetch window is 0.
+   * @param offset
+   * @param length
+   */
+  void prefetch(uint64_t offset, uint64_t length) const;
+
+  /**
+   * @brief prefetchAhead Keeps the reader's prefetch window ahead of a reader that is working through the file
+   * front to back. The window is topped up once less than half of it is left ahead of 'position', so the
+   * requests go out in large pieces. A position past the end of the previously prefetched range starts over there.
+   * @param position Offset within the (uncompressed) file that will be read next
+   * @param prefetchedEnd The value returned by the previous call, 0 for the first one
+   * @return The end of the prefetched range
+   */
+  uint64_t prefetchAhead(uint64_t position, uint64_t prefetchedEnd) const;
+
+  /**
+   * @brief readStoredData Reads 'length' bytes of the file as it is stored in the container, without
+   * inflating it. Runs of physically consecutive chunks are fetched with a single positional read through
+   * the owning SFSReader so this is safe to call from multiple threads at once.
+   * @param offset
+   * @param length
+   * @param dest
+   * @return The number of bytes read or -1 on error
+   */
+  int64_t readStoredData(uint64_t offset, uint64_t length, uint8_t* dest) const;
+
   /**
    * @brief writeFile
    * @param outputfile
+   * @param showProgress Print per file progress to std::cout. Turn this off when several files are written at once.
+   * Progress goes to the reader's progress observer instead when one is set.
+   * @param threadCount Maximum number of ranges of the file that are copied at the same time. The output file
+   * is sized up front and every range is written in place with positional writes. For a compressed file this
+   * is the number of blocks that are inflated at the same time.
    * @return
    */
-  int32_t writeFile(const std::string& outputfile) const;
+  int32_t writeFile(const std::string& outputfile, bool showProgress = true, size_t threadCount = 1) const;
+
+  /**
+   * @brief writeFile Writes the file and adds every written byte to 'progress', which may be shared with the
+   * writes of other files. Stops between two windows of chunks (or compressed blocks) once 'progress' is
+   * canceled and returns SFSProgressObserver::k_CanceledError, leaving the output file incomplete.
+   * @param outputfile
+   * @param progress
+   * @param threadCount
+   * @return
+   */
+  int32_t writeFile(const std::string& outputfile, SFSProgressReporter& progress, size_t threadCount = 1) const;
 
   /**
    * @brief debug
@@ -140,59 +321,154 @@ public:
    * @brief getParentNode
    * @return
    */
-  SFSNodeItem* getParentNode();
+  SFSNodeItem* getParentNode() const;
+
+  /**
+   * @brief setChildren Points the node at its children, which live in the node table of the owning SFSReader
+   * @param children
+   */
+  void setChildren(std::span<SFSNodeItem* const> children);
 
   /**
-   * @brief addChildNode
-   * @param child
+   * @brief childCount
+   * @return
    */
-  void addChildNode(const Pointer &child);
+  size_t childCount() const;
 
   /**
-   * @brief removeChildNode
+   * @brief child
    * @param name
+   * @return The child with the given name or nullptr
    */
-  void removeChildNode(const std::string& name);
+  SFSNodeItem* child(std::string_view name) const;
 
   /**
-   * @brief childCount
+   * @brief children
    * @return
    */
-  size_t childCount();
+  std::span<SFSNodeItem* const> children() const;
 
+protected:
   /**
-   * @brief clearChildren
+   * @brief getPointerTableEntryCount
+   * @return
    */
-  void clearChildren();
+  int32_t getPointerTableEntryCount() const;
 
   /**
-   * @brief child
-   * @param name
+   * @brief loadFilePointerTable Reads the pointer table the first time it is needed. Thread safe.
+   */
+  void loadFilePointerTable() const;
+
+  /**
+   * @brief generateFilePointerTable Walks the chain of pointer table chunks through the owning SFSReader
+   */
+  void generateFilePointerTable() const;
+
+  /**
+   * @brief getMaxRunLength Returns the largest number of chunks that will be fetched with a single read
    * @return
    */
-  Pointer child(const std::string& name);
+  size_t getMaxRunLength() const;
 
   /**
-   * @brief children
+   * @brief findExtent Returns the index of the extent that holds the chunk at 'chunkIndex'
+   * @param chunkIndex
    * @return
    */
-  std::map<std::string, Pointer>& children();
+  size_t findExtent(size_t chunkIndex) const;
 
+  /**
+   * @brief getContiguousRunLength Returns how many chunks starting at 'chunkIndex' are physically
+   * consecutive in the container, i.e. the rest of the extent holding 'chunkIndex'.
+   * @param chunkIndex
+   * @param maxRunLength
+   * @return
+   */
+  size_t getContiguousRunLength(size_t chunkIndex, size_t maxRunLength) const;
 
-protected:
   /**
-   * @brief getPointerTableEntryCount
+   * @brief getPayloadSize Returns the number of file bytes held by 'runLength' chunks starting at 'chunkIndex'
+   * @param chunkIndex
+   * @param runLength
    * @return
    */
-  int32_t getPointerTableEntryCount() const;
+  uint64_t getPayloadSize(size_t chunkIndex, size_t runLength) const;
+
+  /**
+   * @brief readWindow Reads as many chunks starting at 'chunkIndex' as fit into getMaxRunLength() chunks
+   * (but not past 'endChunk') and strips the chunk headers so that the payloads end up back to back at the
+   * start of 'buffer'. Every run of physically consecutive chunks is fetched with a single read, or, when
+   * a ring is given, with many reads in flight at once. The buffer must be able to hold the complete chunks.
+   * @param chunkIndex
+   * @param endChunk
+   * @param buffer
+   * @param ring Optional io_uring to read through. May be nullptr.
+   * @param windowLength Set to the number of chunks that were read
+   * @return The number of payload bytes in the buffer or -1 on a short read.
+   */
+  int64_t readWindow(size_t chunkIndex, size_t endChunk, uint8_t* buffer, SFSIoUring* ring, size_t& windowLength) const;
+
+  /**
+   * @brief prefetchChunks Advises the chunks [firstChunk, endChunk) of the file, one request per run of
+   * physically consecutive chunks
+   * @param firstChunk
+   * @param endChunk
+   */
+  void prefetchChunks(size_t firstChunk, size_t endChunk) const;
+
+  /**
+   * @brief copyChunkRange Copies the payloads of the chunks [firstChunk, endChunk) to the same position
+   * in the output file. Where the kernel supports it the payloads are copied with copy_file_range(),
+   * otherwise reading the next run of chunks overlaps with writing the previous one.
+   * @param firstChunk
+   * @param endChunk
+   * @param outHandle Native handle of the pre-sized output file
+   * @param progress Receives the number of bytes after every write
+   * @return 0 on success or a negative error code
+   */
+  int32_t copyChunkRange(size_t firstChunk, size_t endChunk, intptr_t outHandle, SFSProgressReporter& progress) const;
+
+  /**
+   * @brief writeOutput Writes 'length' bytes at 'offset' of the output file. With direct I/O the range is
+   * written back and dropped from the page cache right away.
+   * @param outHandle
+   * @param offset
+   * @param length
+   * @param data
+   * @return true if every byte was written
+   */
+  bool writeOutput(intptr_t outHandle, uint64_t offset, uint64_t length, const uint8_t* data) const;
 
   /**
-   * @brief generateFilePointerTable
+   * @brief loadCompressedBlocks Reads the block layout of a compressed file the first time it is needed. Thread safe.
    */
-  void generateFilePointerTable(FILE* fin);
+  void loadCompressedBlocks() const;
+
+  /**
+   * @brief generateCompressedBlocks Walks the block headers that follow the compressed data header of the file
+   */
+  void generateCompressedBlocks() const;
+
+  /**
+   * @brief inflateBlocks Inflates every compressed block on up to 'threadCount' threads and writes each one
+   * to its place in the output file
+   * @param outHandle Native handle of the pre-sized output file
+   * @param threadCount
+   * @param progress Receives the number of bytes after every write
+   * @return 0 on success or a negative error code
+   */
+  int32_t inflateBlocks(intptr_t outHandle, size_t threadCount, SFSProgressReporter& progress) const;
 
 private:
-  bool m_IsValid = false;
+  static constexpr size_t k_MaxRunBytes = 32 * 1024 * 1024;
+  static constexpr uint64_t k_IoUringRequestBytes = 1024 * 1024;
+  static constexpr uint64_t k_MinCopyRangeBytes = 256 * 1024;
+  static constexpr uint32_t k_CompressedSignature = 0x53434141; // "AACS"
+  static constexpr uint64_t k_CompressedBlockHeaderSize = 16;
+  static constexpr uint64_t k_FirstCompressedBlockOffset = 0x80;
+
+  mutable bool m_IsValid = false;
   int32_t m_PointerTableInit = 0;
   uint64_t m_FileSize = 0;
   uint64_t m_FileCreationTime = 0;
@@ -200,17 +476,22 @@ private:
   uint64_t m_LastAccessTime = 0;
   uint32_t m_Permissions = 0;
   int32_t m_ParentItemIndex = 0;
-  std::string m_String176;
+  std::string_view m_String176;
   bool m_Directory = true;
-  std::string m_String3;
-  std::string m_FileName = std::string("/");
-  std::string m_String32;
+  std::string_view m_String3;
+  std::string_view m_FileName = "/";
+  std::string_view m_String32;
 
   int32_t m_ChunkCount = 0;
 
-  std::vector<size_t> m_FilePointerTable;
+  mutable std::once_flag m_FilePointerTableLoaded;
+  mutable std::vector<ChunkExtent> m_ChunkExtents;
+
+  mutable std::once_flag m_CompressedBlocksLoaded;
+  mutable std::vector<CompressedBlock> m_CompressedBlocks;
+  mutable uint64_t m_UncompressedSize = 0;
 
   SFSReader* m_Reader = nullptr;
   SFSNodeItem* m_ParentObject = nullptr;
-  std::map<std::string, Pointer> m_Children;
+  std::span<SFSNodeItem* const> m_Children;
 };
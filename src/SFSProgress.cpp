@@ -0,0 +1,116 @@
+/* ============================================================================
+ * Copyright (c) 2019 BlueQuartz Software, LLC
+ * All rights reserved.
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with any project and source this library is coupled.
+ * If not, see <https://www.gnu.org/licenses/#GPL>.
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+#include "SFSProgress.h"
+
+#include <iostream>
+
+// -----------------------------------------------------------------------------
+SFSProgressObserver::SFSProgressObserver() = default;
+
+// -----------------------------------------------------------------------------
+SFSProgressObserver::~SFSProgressObserver() = default;
+
+// -----------------------------------------------------------------------------
+void SFSProgressObserver::cancel()
+{
+  m_Canceled = true;
+}
+
+// -----------------------------------------------------------------------------
+bool SFSProgressObserver::isCanceled() const
+{
+  return m_Canceled;
+}
+
+// -----------------------------------------------------------------------------
+SFSConsoleProgress::SFSConsoleProgress() = default;
+
+// -----------------------------------------------------------------------------
+SFSConsoleProgress::~SFSConsoleProgress() = default;
+
+// -----------------------------------------------------------------------------
+void SFSConsoleProgress::updateProgress(const Progress& progress)
+{
+  const uint64_t percent = progress.totalBytes == 0 ? 100 : progress.bytesDone * 100 / progress.totalBytes;
+  std::cout << progress.stage << " " << progress.totalBytes << " [" << percent << "%] " << static_cast<uint64_t>(progress.bytesPerSecond / (1024.0 * 1024.0)) << " MB/s\r";
+  if(progress.finished)
+  {
+    std::cout << std::endl;
+  }
+  else
+  {
+    std::cout.flush();
+  }
+}
+
+// -----------------------------------------------------------------------------
+SFSProgressReporter::SFSProgressReporter(SFSProgressObserver* observer, std::string stage, uint64_t totalBytes)
+: m_Observer(observer)
+, m_StartTime(std::chrono::steady_clock::now())
+, m_LastReport(m_StartTime)
+{
+  m_Progress.stage = std::move(stage);
+  m_Progress.totalBytes = totalBytes;
+}
+
+// -----------------------------------------------------------------------------
+SFSProgressReporter::~SFSProgressReporter() = default;
+
+// -----------------------------------------------------------------------------
+void SFSProgressReporter::add(uint64_t numBytes)
+{
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  m_Progress.bytesDone += numBytes;
+  if(m_Observer == nullptr)
+  {
+    return;
+  }
+  const auto now = std::chrono::steady_clock::now();
+  if(now - m_LastReport >= k_ReportInterval)
+  {
+    report(now);
+  }
+}
+
+// -----------------------------------------------------------------------------
+void SFSProgressReporter::finish()
+{
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  if(m_Observer == nullptr || m_Progress.finished)
+  {
+    return;
+  }
+  m_Progress.finished = true;
+  report(std::chrono::steady_clock::now());
+}
+
+// -----------------------------------------------------------------------------
+bool SFSProgressReporter::isCanceled() const
+{
+  return m_Observer != nullptr && m_Observer->isCanceled();
+}
+
+// -----------------------------------------------------------------------------
+void SFSProgressReporter::report(std::chrono::steady_clock::time_point now)
+{
+  const double seconds = std::chrono::duration<double>(now - m_StartTime).count();
+  m_Progress.bytesPerSecond = seconds > 0.0 ? static_cast<double>(m_Progress.bytesDone) / seconds : 0.0;
+  m_LastReport = now;
+  m_Observer->updateProgress(m_Progress);
+}
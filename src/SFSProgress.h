@@ -0,0 +1,151 @@
+/* ============================================================================
+ * Copyright (c) 2019 BlueQuartz Software, LLC
+ * All rights reserved.
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with any project and source this library is coupled.
+ * If not, see <https://www.gnu.org/licenses/#GPL>.
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+/**
+ * @brief The SFSProgressObserver class receives progress reports from long running work in the SFS and
+ * conversion layers, for example SFSReader::extractAll() or BcfHdf5Convertor::execute(), and lets the caller
+ * cancel that work. Reports and cancellation checks may come from worker threads, so implementations must
+ * be thread safe.
+ */
+class SFSProgressObserver
+{
+public:
+  /**
+   * @brief Error code returned by work that stopped because it was canceled
+   */
+  static constexpr int32_t k_CanceledError = -7;
+
+  struct Progress
+  {
+    std::string stage;           // What is being worked on, for example "Extracting input.bcf"
+    uint64_t bytesDone = 0;      // Bytes of the stage that are done
+    uint64_t totalBytes = 0;     // Bytes of the stage in total
+    double bytesPerSecond = 0.0; // Average rate since the stage started
+    bool finished = false;       // Set on the last report of the stage
+  };
+
+  SFSProgressObserver();
+  virtual ~SFSProgressObserver();
+
+  SFSProgressObserver(const SFSProgressObserver&) = delete;            // Copy Constructor Not Implemented
+  SFSProgressObserver(SFSProgressObserver&&) = delete;                 // Move Constructor Not Implemented
+  SFSProgressObserver& operator=(const SFSProgressObserver&) = delete; // Copy Assignment Not Implemented
+  SFSProgressObserver& operator=(SFSProgressObserver&&) = delete;      // Move Assignment Not Implemented
+
+  /**
+   * @brief updateProgress Called at most every SFSProgressReporter::k_ReportInterval while a stage runs
+   * and once more when it is finished
+   * @param progress
+   */
+  virtual void updateProgress(const Progress& progress) = 0;
+
+  /**
+   * @brief cancel Asks the running work to stop. It stops between two batches of work and returns
+   * k_CanceledError. May be called from any thread.
+   */
+  void cancel();
+
+  /**
+   * @brief isCanceled Polled between batches of work. Override this to cancel from somewhere else,
+   * for example a job scheduler.
+   * @return true once cancel() was called
+   */
+  virtual bool isCanceled() const;
+
+private:
+  std::atomic<bool> m_Canceled = false;
+};
+
+/**
+ * @brief The SFSConsoleProgress class prints each report to std::cout on a single line that the next report
+ * overwrites. This is what the command line programs use.
+ */
+class SFSConsoleProgress : public SFSProgressObserver
+{
+public:
+  SFSConsoleProgress();
+  ~SFSConsoleProgress() override;
+
+  SFSConsoleProgress(const SFSConsoleProgress&) = delete;            // Copy Constructor Not Implemented
+  SFSConsoleProgress(SFSConsoleProgress&&) = delete;                 // Move Constructor Not Implemented
+  SFSConsoleProgress& operator=(const SFSConsoleProgress&) = delete; // Copy Assignment Not Implemented
+  SFSConsoleProgress& operator=(SFSConsoleProgress&&) = delete;      // Move Assignment Not Implemented
+
+  void updateProgress(const Progress& progress) override;
+};
+
+/**
+ * @brief The SFSProgressReporter class counts the bytes of one stage and passes them on to an observer at
+ * most every k_ReportInterval, so that it can be called from hot loops. Safe to use from many threads at once.
+ */
+class SFSProgressReporter
+{
+public:
+  static constexpr std::chrono::milliseconds k_ReportInterval{250};
+
+  /**
+   * @param observer Receives the reports. May be nullptr, which only counts the bytes.
+   * @param stage
+   * @param totalBytes
+   */
+  SFSProgressReporter(SFSProgressObserver* observer, std::string stage, uint64_t totalBytes);
+  ~SFSProgressReporter();
+
+  SFSProgressReporter(const SFSProgressReporter&) = delete;            // Copy Constructor Not Implemented
+  SFSProgressReporter(SFSProgressReporter&&) = delete;                 // Move Constructor Not Implemented
+  SFSProgressReporter& operator=(const SFSProgressReporter&) = delete; // Copy Assignment Not Implemented
+  SFSProgressReporter& operator=(SFSProgressReporter&&) = delete;      // Move Assignment Not Implemented
+
+  /**
+   * @brief add Adds 'numBytes' to the bytes done and reports them if the last report is old enough
+   * @param numBytes
+   */
+  void add(uint64_t numBytes);
+
+  /**
+   * @brief finish Sends the final report of the stage. Later calls do nothing.
+   */
+  void finish();
+
+  /**
+   * @brief isCanceled
+   * @return true if the observer asks for the work to stop
+   */
+  bool isCanceled() const;
+
+private:
+  /**
+   * @brief report Sends the current state to the observer. The mutex must be held.
+   * @param now
+   */
+  void report(std::chrono::steady_clock::time_point now);
+
+  SFSProgressObserver* m_Observer = nullptr;
+  SFSProgressObserver::Progress m_Progress;
+  std::chrono::steady_clock::time_point m_StartTime;
+  std::chrono::steady_clock::time_point m_LastReport;
+  std::mutex m_Mutex;
+};
@@ -30,29 +30,428 @@
 
 #include <sys/stat.h>
 
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
 #include <array>
+#include <atomic>
 #include <cmath>
 #include <cstdint>
 #include <cstdio>
+#include <cstring>
 #include <iostream>
-#include <map>
-#include <sstream>
+#include <mutex>
+#include <span>
 #include <string>
+#include <string_view>
 #include <vector>
 
+#include "SFSIoUring.h"
 #include "SFSNodeItem.h"
+#include "SFSProgress.h"
 #include "SFSUtils.hpp"
+#include "ThreadPool.hpp"
 
 namespace BCF
 {
 const char k_SFSMagic[8] = {'A', 'A', 'M', 'V', 'H', 'F', 'S', 'S'};
+const char k_IndexMagic[8] = {'S', 'F', 'S', 'I', 'D', 'X', '0', '1'};
+const std::array<char, 4> k_CompressedSignature = {'A', 'A', 'C', 'S'};
+const uint32_t k_IndexFormatVersion = 1;
+const char k_IndexExtension[] = "idx";
+} // namespace BCF
+
+namespace
+{
+// -----------------------------------------------------------------------------
+template <typename T>
+void appendScalar(std::vector<uint8_t>& buffer, T value)
+{
+  const auto* bytes = reinterpret_cast<const uint8_t*>(&value);
+  buffer.insert(buffer.end(), bytes, bytes + sizeof(T));
+}
+
+// -----------------------------------------------------------------------------
+template <typename T>
+bool takeScalar(const std::vector<uint8_t>& buffer, size_t& pos, T& value)
+{
+  if(buffer.size() - pos < sizeof(T))
+  {
+    return false;
+  }
+  ::memcpy(&value, buffer.data() + pos, sizeof(T));
+  pos += sizeof(T);
+  return true;
 }
 
+// -----------------------------------------------------------------------------
+constexpr uint64_t k_FnvOffsetBasis = 14695981039346656037ULL;
+constexpr uint64_t k_FnvPrime = 1099511628211ULL;
+constexpr uint32_t k_DetachedNode = UINT32_MAX;
+
+// -----------------------------------------------------------------------------
+uint64_t hashPath(std::string_view text, uint64_t hash = k_FnvOffsetBasis)
+{
+  for(char c : text)
+  {
+    hash ^= static_cast<uint8_t>(c);
+    hash *= k_FnvPrime;
+  }
+  return hash;
+}
+
+// -----------------------------------------------------------------------------
+bool matchesPath(const SFSNodeItem* node, const SFSNodeItem* root, std::string_view path)
+{
+  // Compare the names from the node up to the root against the path from the back
+  while(true)
+  {
+    std::string_view name = node->getFileNameView();
+    if(path.size() < name.size() || path.substr(path.size() - name.size()) != name)
+    {
+      return false;
+    }
+    path.remove_suffix(name.size());
+    node = node->getParentNode();
+    if(node == root)
+    {
+      return path.empty();
+    }
+    if(node == nullptr || path.empty() || path.back() != '/')
+    {
+      return false;
+    }
+    path.remove_suffix(1);
+  }
+}
+
+// -----------------------------------------------------------------------------
+bool getContainerStamp(const std::string& filePath, uint64_t& size, int64_t& modificationTime)
+{
+  SFS_UTIL_STATBUF st;
+  if(SFS_UTIL_STAT(filePath.c_str(), &st) != 0)
+  {
+    return false;
+  }
+  size = static_cast<uint64_t>(st.st_size);
+  modificationTime = static_cast<int64_t>(st.st_mtime);
+  return true;
+}
+
+// -----------------------------------------------------------------------------
+void collectFiles(const std::string& outputDir, const SFSNodeItem* node, std::vector<std::pair<std::string, const SFSNodeItem*>>& files)
+{
+  for(const SFSNodeItem* child : node->children())
+  {
+    std::string path = outputDir + "/" + child->getFileName();
+    if(child->isDirectory())
+    {
+      SFSUtils::mkdir(path, true);
+      collectFiles(path, child, files);
+    }
+    else
+    {
+      files.emplace_back(path, child);
+    }
+  }
+}
+} // namespace
+
+// -----------------------------------------------------------------------------
+struct SFSReader::NodeTable
+{
+  std::vector<uint8_t> rawTree;         // The raw 512 byte tree items. The node names point into it.
+  std::unique_ptr<SFSNodeItem[]> nodes; // Node 0 is the root, tree item i is node i + 1
+  size_t nodeCount = 0;
+  std::vector<SFSNodeItem*> children; // The children of every node, grouped by parent
+  std::vector<uint32_t> pathSlots;    // Open addressing hash table from full path to node index. 0 is empty.
+};
+
 // -----------------------------------------------------------------------------
 SFSReader::SFSReader() = default;
 
 // -----------------------------------------------------------------------------
-SFSReader::~SFSReader() = default;
+SFSReader::~SFSReader()
+{
+  // Let the queued asynchronous requests finish while the input is still open
+  m_IoPool.reset();
+  unmapFile();
+  SFSUtils::closeFile(m_InputHandle);
+}
+
+// -----------------------------------------------------------------------------
+void SFSReader::setUseMemoryMap(bool useMemoryMap)
+{
+  m_UseMemoryMap = useMemoryMap;
+}
+
+// -----------------------------------------------------------------------------
+bool SFSReader::getUseMemoryMap() const
+{
+  return m_UseMemoryMap;
+}
+
+// -----------------------------------------------------------------------------
+void SFSReader::setUseIoUring(bool useIoUring)
+{
+  m_UseIoUring = useIoUring;
+}
+
+// -----------------------------------------------------------------------------
+bool SFSReader::getUseIoUring() const
+{
+  return m_UseIoUring && SFSIoUring::IsSupported();
+}
+
+// -----------------------------------------------------------------------------
+void SFSReader::setUseCopyFileRange(bool useCopyFileRange)
+{
+  m_UseCopyFileRange = useCopyFileRange;
+}
+
+// -----------------------------------------------------------------------------
+bool SFSReader::getUseCopyFileRange() const
+{
+#if defined(__linux__)
+  return m_UseCopyFileRange;
+#else
+  return false;
+#endif
+}
+
+// -----------------------------------------------------------------------------
+void SFSReader::setUseDirectIO(bool useDirectIO)
+{
+  m_UseDirectIO = useDirectIO;
+}
+
+// -----------------------------------------------------------------------------
+bool SFSReader::getUseDirectIO() const
+{
+  return m_DirectInput;
+}
+
+// -----------------------------------------------------------------------------
+void SFSReader::setPrefetchWindow(uint64_t prefetchWindow)
+{
+  m_PrefetchWindow = prefetchWindow;
+}
+
+// -----------------------------------------------------------------------------
+uint64_t SFSReader::getPrefetchWindow() const
+{
+  return m_DirectInput ? 0 : m_PrefetchWindow;
+}
+
+// -----------------------------------------------------------------------------
+void SFSReader::adviseWillNeed(uint64_t filePos, uint64_t length) const
+{
+  if(m_MappedData == nullptr)
+  {
+    SFSUtils::adviseWillNeed(m_InputHandle, filePos, length);
+    return;
+  }
+#if !defined(_WIN32)
+  if(filePos >= m_MappedSize)
+  {
+    return;
+  }
+  // The advised address has to be page aligned
+  const uint64_t pageSize = static_cast<uint64_t>(::sysconf(_SC_PAGESIZE));
+  const uint64_t start = filePos - filePos % pageSize;
+  length = std::min(length + (filePos - start), m_MappedSize - start);
+  ::posix_madvise(const_cast<uint8_t*>(m_MappedData + start), static_cast<size_t>(length), POSIX_MADV_WILLNEED);
+#endif
+}
+
+// -----------------------------------------------------------------------------
+void SFSReader::setProgressObserver(SFSProgressObserver* observer)
+{
+  m_ProgressObserver = observer;
+}
+
+// -----------------------------------------------------------------------------
+SFSProgressObserver* SFSReader::getProgressObserver() const
+{
+  return m_ProgressObserver;
+}
+
+// -----------------------------------------------------------------------------
+void SFSReader::setUseSweepExtraction(bool useSweepExtraction)
+{
+  m_UseSweepExtraction = useSweepExtraction;
+}
+
+// -----------------------------------------------------------------------------
+bool SFSReader::getUseSweepExtraction() const
+{
+  return m_UseSweepExtraction;
+}
+
+// -----------------------------------------------------------------------------
+void SFSReader::setAsyncThreadCount(size_t asyncThreadCount)
+{
+  m_AsyncThreadCount = asyncThreadCount;
+}
+
+// -----------------------------------------------------------------------------
+size_t SFSReader::getAsyncThreadCount() const
+{
+  return m_AsyncThreadCount;
+}
+
+// -----------------------------------------------------------------------------
+ThreadPool& SFSReader::getIoPool() const
+{
+  std::call_once(m_IoPoolStarted, [this]() { m_IoPool = std::make_unique<ThreadPool>(m_AsyncThreadCount); });
+  return *m_IoPool;
+}
+
+// -----------------------------------------------------------------------------
+void SFSReader::setUseIndexCache(bool useIndexCache)
+{
+  m_UseIndexCache = useIndexCache;
+}
+
+// -----------------------------------------------------------------------------
+bool SFSReader::getUseIndexCache() const
+{
+  return m_UseIndexCache;
+}
+
+// -----------------------------------------------------------------------------
+void SFSReader::setIndexCacheDirectory(const std::string& indexCacheDirectory)
+{
+  m_IndexCacheDirectory = indexCacheDirectory;
+}
+
+// -----------------------------------------------------------------------------
+const std::string& SFSReader::getIndexCacheDirectory() const
+{
+  return m_IndexCacheDirectory;
+}
+
+// -----------------------------------------------------------------------------
+std::string SFSReader::getIndexFilePath() const
+{
+  if(m_IndexCacheDirectory.empty())
+  {
+    return m_FilePath + BCF::k_IndexExtension;
+  }
+  std::string fileName = m_FilePath;
+  size_t slashPos = fileName.find_last_of("/\\");
+  if(slashPos != std::string::npos)
+  {
+    fileName = fileName.substr(slashPos + 1);
+  }
+  return m_IndexCacheDirectory + "/" + fileName + BCF::k_IndexExtension;
+}
+
+// -----------------------------------------------------------------------------
+intptr_t SFSReader::getInputHandle() const
+{
+  return m_InputHandle;
+}
+
+// -----------------------------------------------------------------------------
+bool SFSReader::isMemoryMapped() const
+{
+  return m_MappedData != nullptr;
+}
+
+// -----------------------------------------------------------------------------
+const uint8_t* SFSReader::getMappedData() const
+{
+  return m_MappedData;
+}
+
+// -----------------------------------------------------------------------------
+uint64_t SFSReader::getMappedSize() const
+{
+  return m_MappedSize;
+}
+
+// -----------------------------------------------------------------------------
+int32_t SFSReader::mapFile()
+{
+  unmapFile();
+#if defined(_WIN32)
+  HANDLE fileHandle = ::CreateFileA(m_FilePath.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+  if(fileHandle == INVALID_HANDLE_VALUE)
+  {
+    return -20;
+  }
+  LARGE_INTEGER fileSize;
+  if(::GetFileSizeEx(fileHandle, &fileSize) == 0 || fileSize.QuadPart == 0)
+  {
+    ::CloseHandle(fileHandle);
+    return -21;
+  }
+  HANDLE mappingHandle = ::CreateFileMappingA(fileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  if(mappingHandle == nullptr)
+  {
+    ::CloseHandle(fileHandle);
+    return -22;
+  }
+  void* data = ::MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0);
+  if(data == nullptr)
+  {
+    ::CloseHandle(mappingHandle);
+    ::CloseHandle(fileHandle);
+    return -23;
+  }
+  m_FileHandle = fileHandle;
+  m_MappingHandle = mappingHandle;
+  m_MappedData = static_cast<const uint8_t*>(data);
+  m_MappedSize = static_cast<uint64_t>(fileSize.QuadPart);
+#else
+  int fd = ::open(m_FilePath.c_str(), O_RDONLY);
+  if(fd < 0)
+  {
+    return -20;
+  }
+  SFS_UTIL_STATBUF st;
+  if(SFS_UTIL_FSTAT(fd, &st) != 0 || st.st_size == 0)
+  {
+    ::close(fd);
+    return -21;
+  }
+  void* data = ::mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+  // The mapping keeps its own reference to the file so the descriptor is no longer needed.
+  ::close(fd);
+  if(data == MAP_FAILED)
+  {
+    return -23;
+  }
+  m_MappedData = static_cast<const uint8_t*>(data);
+  m_MappedSize = static_cast<uint64_t>(st.st_size);
+#endif
+  return 0;
+}
+
+// -----------------------------------------------------------------------------
+void SFSReader::unmapFile()
+{
+  if(m_MappedData == nullptr)
+  {
+    return;
+  }
+#if defined(_WIN32)
+  ::UnmapViewOfFile(m_MappedData);
+  ::CloseHandle(static_cast<HANDLE>(m_MappingHandle));
+  ::CloseHandle(static_cast<HANDLE>(m_FileHandle));
+  m_MappingHandle = nullptr;
+  m_FileHandle = nullptr;
+#else
+  ::munmap(const_cast<uint8_t*>(m_MappedData), static_cast<size_t>(m_MappedSize));
+#endif
+  m_MappedData = nullptr;
+  m_MappedSize = 0;
+}
 
 // -----------------------------------------------------------------------------
 float SFSReader::getVersion() const
@@ -80,19 +479,196 @@ const std::string& SFSReader::getInputFile() const
 // -----------------------------------------------------------------------------
 SFSNodeItemPtr SFSReader::getRootNode() const
 {
-  return m_RootNode;
+  if(m_NodeTable == nullptr)
+  {
+    return nullptr;
+  }
+  return getNode(0);
+}
+
+// -----------------------------------------------------------------------------
+SFSNodeItemPtr SFSReader::getNode(size_t nodeIndex) const
+{
+  return SFSNodeItemPtr(m_NodeTable, &m_NodeTable->nodes[nodeIndex]);
 }
 
 // -----------------------------------------------------------------------------
 int SFSReader::parseFile(const std::string& filepath)
 {
+  if(m_IoPool != nullptr)
+  {
+    m_IoPool->waitForAll();
+  }
+  unmapFile();
+  SFSUtils::closeFile(m_InputHandle);
+  m_InputHandle = SFSUtils::k_InvalidFileHandle;
   m_FilePath = filepath;
 
+  // Keep one descriptor open for every later member read. Pointer tables are read through it on demand.
+  m_DirectInput = false;
+  if(m_UseDirectIO)
+  {
+    m_InputHandle = SFSUtils::openFileForReading(m_FilePath, true);
+    m_DirectInput = m_InputHandle != SFSUtils::k_InvalidFileHandle;
+    if(!m_DirectInput)
+    {
+      std::cout << "Could not open '" << m_FilePath << "' for direct I/O. Falling back to regular file I/O." << std::endl;
+    }
+  }
+  if(m_InputHandle == SFSUtils::k_InvalidFileHandle)
+  {
+    m_InputHandle = SFSUtils::openFileForReading(m_FilePath);
+  }
+  if(m_InputHandle == SFSUtils::k_InvalidFileHandle)
+  {
+    std::cout << "Error opening file '" << filepath << "'" << std::endl;
+    return -2;
+  }
+
+  // A mapping is served out of the page cache, which is exactly what direct I/O is meant to avoid
+  if(m_UseMemoryMap && !m_DirectInput && mapFile() < 0)
+  {
+    std::cout << "Could not memory map '" << m_FilePath << "'. Falling back to regular file I/O." << std::endl;
+  }
+
+  m_NodeTable.reset();
+  m_Compressed = false;
+  int32_t err = 0;
+  if(!m_UseIndexCache || readIndexFile() < 0)
+  {
+    std::vector<uint8_t> rawTreeBuffer;
+    err = parseContainer(rawTreeBuffer);
+    if(err < -1)
+    {
+      // The container could not be opened or is not an SFS file. -1 only means part of the tree could not be read.
+      return err;
+    }
+    buildNodeTable(std::move(rawTreeBuffer));
+    if(err == 0 && m_UseIndexCache)
+    {
+      writeIndexFile();
+    }
+  }
+  detectCompression();
+
+  // getRootNode()->printTree(std::cout, 0);
+
+  return err;
+}
+
+// -----------------------------------------------------------------------------
+void SFSReader::detectCompression()
+{
+  // The header has no compression flag. Compressed containers store every file as a compressed data header
+  // followed by zlib blocks, so the first file with any data tells which kind of container this is.
+  for(size_t i = 1; i < m_NodeTable->nodeCount; i++)
+  {
+    const SFSNodeItem& node = m_NodeTable->nodes[i];
+    if(node.isDirectory() || node.getFileSize() < BCF::k_CompressedSignature.size())
+    {
+      continue;
+    }
+    std::array<char, 4> signature = {0, 0, 0, 0};
+    if(node.readStoredData(0, signature.size(), reinterpret_cast<uint8_t*>(signature.data())) == static_cast<int64_t>(signature.size()))
+    {
+      m_Compressed = (signature == BCF::k_CompressedSignature);
+    }
+    return;
+  }
+}
+
+// -----------------------------------------------------------------------------
+bool SFSReader::isCompressed() const
+{
+  return m_Compressed;
+}
+
+// -----------------------------------------------------------------------------
+void SFSReader::buildNodeTable(std::vector<uint8_t> rawTreeBuffer)
+{
+  auto table = std::make_shared<NodeTable>();
+  table->rawTree = std::move(rawTreeBuffer);
+  table->nodeCount = std::min<size_t>(m_NumTreeItems, table->rawTree.size() / 512) + 1;
+  table->nodes = std::make_unique<SFSNodeItem[]>(table->nodeCount);
+  SFSNodeItem* nodes = table->nodes.get();
+  const size_t nodeCount = table->nodeCount;
+
+  // Count the children of every node. Items whose parent index is out of range are left out of the tree.
+  std::vector<uint32_t> parents(nodeCount, k_DetachedNode);
+  std::vector<uint32_t> childOffsets(nodeCount + 1, 0);
+  for(size_t i = 1; i < nodeCount; i++)
+  {
+    nodes[i].setTreeItem(table->rawTree.data() + (i - 1) * 512, this);
+    int32_t parentIndex = nodes[i].getParentItemIndex();
+    if(parentIndex >= -1 && parentIndex + 1 < static_cast<int64_t>(nodeCount) && static_cast<size_t>(parentIndex + 1) != i)
+    {
+      parents[i] = static_cast<uint32_t>(parentIndex + 1);
+      childOffsets[parents[i] + 1]++;
+    }
+  }
+  for(size_t i = 1; i <= nodeCount; i++)
+  {
+    childOffsets[i] += childOffsets[i - 1];
+  }
+
+  // Store the children of each node back to back so every node can point at its own slice
+  table->children.resize(childOffsets[nodeCount]);
+  std::vector<uint32_t> nextChild(childOffsets.begin(), childOffsets.end() - 1);
+  for(size_t i = 1; i < nodeCount; i++)
+  {
+    if(parents[i] != k_DetachedNode)
+    {
+      table->children[nextChild[parents[i]]++] = nodes + i;
+      nodes[i].setParentNode(nodes + parents[i]);
+    }
+  }
+  std::span<SFSNodeItem* const> allChildren(table->children);
+  for(size_t i = 0; i < nodeCount; i++)
+  {
+    nodes[i].setChildren(allChildren.subspan(childOffsets[i], childOffsets[i + 1] - childOffsets[i]));
+  }
+
+  // Hash the full path of every node reachable from the root, e.g. "EBSDData/FrameData"
+  size_t slotCount = 16;
+  while(slotCount < nodeCount * 2)
+  {
+    slotCount *= 2;
+  }
+  table->pathSlots.assign(slotCount, 0);
+  std::vector<std::pair<SFSNodeItem*, uint64_t>> pending;
+  for(SFSNodeItem* child : nodes[0].children())
+  {
+    pending.emplace_back(child, hashPath(child->getFileNameView()));
+  }
+  while(!pending.empty())
+  {
+    auto [node, hash] = pending.back();
+    pending.pop_back();
+    size_t slot = hash & (slotCount - 1);
+    while(table->pathSlots[slot] != 0)
+    {
+      slot = (slot + 1) & (slotCount - 1);
+    }
+    table->pathSlots[slot] = static_cast<uint32_t>(node - nodes);
+
+    uint64_t prefixHash = hashPath("/", hash);
+    for(SFSNodeItem* child : node->children())
+    {
+      pending.emplace_back(child, hashPath(child->getFileNameView(), prefixHash));
+    }
+  }
+
+  m_NodeTable = table;
+}
+
+// -----------------------------------------------------------------------------
+int32_t SFSReader::parseContainer(std::vector<uint8_t>& rawTreeBuffer)
+{
   int32_t err = 0;
   FILE* fin = fopen(m_FilePath.c_str(), "rb");
   if(nullptr == fin)
   {
-    std::cout << "Error opening file '" << filepath << "'" << std::endl;
+    std::cout << "Error opening file '" << m_FilePath << "'" << std::endl;
     return -2;
   }
 
@@ -125,7 +701,8 @@ int SFSReader::parseFile(const std::string& filepath)
     return -4;
   }
   m_ChunkSize = SFSUtils::readScalar<uint32_t>(fin, err);
-  if(err == 1)
+  // A chunk has to hold at least its 32 byte header and one tree item
+  if(err == 1 || m_ChunkSize < 544)
   {
     fclose(fin);
     std::cout << "Error reading chunkSize" << std::endl;
@@ -159,19 +736,19 @@ int SFSReader::parseFile(const std::string& filepath)
   //  std::cout << "m_NumTreeItems: " << m_NumTreeItems << std::endl;
   //  std::cout << "m_NumChunks: " << m_NumChunks << std::endl;
 
-  // Create all the headers to convert into SFSNodeItems
-  int32_t fileTreeChunks = static_cast<int32_t>(std::ceil((m_NumTreeItems * 512.0f) / (m_ChunkSize - 32.0f)));
+  // Create all the headers to convert into SFSNodeItems. Tree items never straddle two chunks.
+  int32_t numTreeItemsInChunk = static_cast<int32_t>(std::floor((m_ChunkSize - 32.0f) / 512.0f));
+  int32_t fileTreeChunks = static_cast<int32_t>(std::ceil(static_cast<float>(m_NumTreeItems) / static_cast<float>(numTreeItemsInChunk)));
   //  std::cout << "fileTreeChunks: " << fileTreeChunks << std::endl;
-  std::vector<uint8_t> rawTreeBuffer;
   if(fileTreeChunks == 1)
   {
     // file tree does not exceed one chunk in bcf:
     size_t offset = m_ChunkSize * m_TreeAddress + 312;
     SFS_UTIL_FSEEK(fin, offset, SEEK_SET);
     size_t rawTreeCount = 512 * m_NumTreeItems;
-    rawTreeBuffer.resize(rawTreeCount * sizeof(int32_t));
+    rawTreeBuffer.resize(rawTreeCount);
 
-    nread = fread(rawTreeBuffer.data(), 4, rawTreeCount, fin);
+    nread = fread(rawTreeBuffer.data(), 1, rawTreeCount, fin);
     if(nread != rawTreeCount)
     {
       std::cout << "sfsReader::parseFile(" << __LINE__ << ") error reading bytes: " << ferror(fin) << std::endl;
@@ -183,7 +760,6 @@ int SFSReader::parseFile(const std::string& filepath)
   else
   {
     uint32_t treeAddress = m_TreeAddress;
-    int32_t numTreeItemsInChunk = static_cast<int32_t>(std::floor((m_ChunkSize - 32.0f) / 512.0f));
     size_t bytesToRead = numTreeItemsInChunk * 512;
     rawTreeBuffer.resize(fileTreeChunks * numTreeItemsInChunk * 512); // Allocate all the space for the header
     uint8_t* rawTreeBufferPtr = rawTreeBuffer.data();
@@ -201,132 +777,601 @@ int SFSReader::parseFile(const std::string& filepath)
     }
   }
 
-  // Create SFSNodeItems
-  std::map<int32_t, SFSNodeItemPtr> indexNodeMap;
-  m_RootNode = std::make_shared<SFSNodeItem>();
-  // SFSNodeItemPtr(new SFSNodeItem);
+  fclose(fin);
+  fin = nullptr;
+
+  return err;
+}
 
-  // Read all the 512 byte headers for each tree item
-  for(uint32_t i = 0; i < m_NumTreeItems; i++)
+// -----------------------------------------------------------------------------
+int32_t SFSReader::readIndexFile()
+{
+  uint64_t containerSize = 0;
+  int64_t containerTime = 0;
+  uint64_t indexSize = 0;
+  int64_t indexTime = 0;
+  std::string indexPath = getIndexFilePath();
+  if(!getContainerStamp(m_FilePath, containerSize, containerTime) || !getContainerStamp(indexPath, indexSize, indexTime))
   {
-    // std::cout << "---------------  SFSTreeItem  -------------------" << std::endl;
-    SFSNodeItemPtr item = std::make_shared<SFSNodeItem>(rawTreeBuffer.data() + (i * 512), fin, this);
-    indexNodeMap[i] = item;
-    if(item->getParentItemIndex() == -1)
+    return -1;
+  }
+
+  FILE* fin = fopen(indexPath.c_str(), "rb");
+  if(nullptr == fin)
+  {
+    return -1;
+  }
+  std::vector<uint8_t> buffer(indexSize);
+  size_t nread = fread(buffer.data(), 1, buffer.size(), fin);
+  fclose(fin);
+  if(nread != buffer.size() || buffer.size() < sizeof(BCF::k_IndexMagic) || ::memcmp(buffer.data(), BCF::k_IndexMagic, sizeof(BCF::k_IndexMagic)) != 0)
+  {
+    return -2;
+  }
+
+  size_t pos = sizeof(BCF::k_IndexMagic);
+  uint32_t formatVersion = 0;
+  uint64_t storedSize = 0;
+  int64_t storedTime = 0;
+  if(!takeScalar(buffer, pos, formatVersion) || formatVersion != BCF::k_IndexFormatVersion || !takeScalar(buffer, pos, storedSize) || !takeScalar(buffer, pos, storedTime))
+  {
+    return -3;
+  }
+  if(storedSize != containerSize || storedTime != containerTime)
+  {
+    // The container changed since the index was written
+    return -4;
+  }
+
+  float version = 0.0f;
+  uint32_t chunkSize = 0;
+  uint32_t treeAddress = 0;
+  uint32_t numTreeItems = 0;
+  uint32_t numChunks = 0;
+  if(!takeScalar(buffer, pos, version) || !takeScalar(buffer, pos, chunkSize) || !takeScalar(buffer, pos, treeAddress) || !takeScalar(buffer, pos, numTreeItems) ||
+     !takeScalar(buffer, pos, numChunks) || chunkSize <= 32)
+  {
+    return -5;
+  }
+  size_t rawTreeSize = static_cast<size_t>(numTreeItems) * 512;
+  if(buffer.size() - pos < rawTreeSize)
+  {
+    return -5;
+  }
+  std::vector<uint8_t> rawTree(buffer.begin() + pos, buffer.begin() + pos + rawTreeSize);
+  pos += rawTreeSize;
+
+  // The nodes need the chunk sizes to work out their chunk counts
+  m_Version = version;
+  m_ChunkSize = chunkSize;
+  m_UsableChunkSize = chunkSize - 32;
+  m_TreeAddress = treeAddress;
+  m_NumTreeItems = numTreeItems;
+  m_NumChunks = numChunks;
+
+  buildNodeTable(std::move(rawTree));
+
+  for(size_t i = 1; i < m_NodeTable->nodeCount; i++)
+  {
+    uint32_t extentCount = 0;
+    if(!takeScalar(buffer, pos, extentCount) || extentCount > (buffer.size() - pos) / 12)
     {
-      m_RootNode->addChildNode(item);
+      m_NodeTable.reset();
+      return -6;
     }
-    else
+    std::vector<SFSNodeItem::ChunkExtent> chunkExtents(extentCount);
+    uint64_t chunkTotal = 0;
+    for(auto& extent : chunkExtents)
     {
-      SFSNodeItemPtr parent = indexNodeMap[item->getParentItemIndex()];
-      parent->addChildNode(item);
+      uint32_t count = 0;
+      if(!takeScalar(buffer, pos, extent.filePos) || !takeScalar(buffer, pos, count) || count == 0 ||
+         extent.filePos + static_cast<uint64_t>(count) * chunkSize > containerSize + 32)
+      {
+        m_NodeTable.reset();
+        return -6;
+      }
+      extent.firstChunk = chunkTotal;
+      chunkTotal += count;
+    }
+    SFSNodeItem& item = m_NodeTable->nodes[i];
+    item.setChunkExtents(std::move(chunkExtents));
+    if(!item.getIsValid() || (!item.isDirectory() && chunkTotal != static_cast<uint64_t>(item.getChunkCount())))
+    {
+      m_NodeTable.reset();
+      return -6;
     }
   }
 
-  // m_RootNode->printTree(std::cout, 0);
-
-  fclose(fin);
-  fin = nullptr;
-
-  return err;
+  return 0;
 }
 
 // -----------------------------------------------------------------------------
-void saveFile(const std::string& outputDir, const SFSNodeItemPtr& node)
+int32_t SFSReader::writeIndexFile() const
 {
-  int err = 0;
+  uint64_t containerSize = 0;
+  int64_t containerTime = 0;
+  if(m_NodeTable == nullptr || !getContainerStamp(m_FilePath, containerSize, containerTime) || m_NodeTable->nodeCount != static_cast<size_t>(m_NumTreeItems) + 1)
+  {
+    return -1;
+  }
 
-  std::map<std::string, SFSNodeItemPtr> children = node->children();
-  for(const auto& child : children)
+  std::vector<uint8_t> buffer(BCF::k_IndexMagic, BCF::k_IndexMagic + sizeof(BCF::k_IndexMagic));
+  appendScalar(buffer, BCF::k_IndexFormatVersion);
+  appendScalar(buffer, containerSize);
+  appendScalar(buffer, containerTime);
+  appendScalar(buffer, m_Version);
+  appendScalar(buffer, m_ChunkSize);
+  appendScalar(buffer, m_TreeAddress);
+  appendScalar(buffer, m_NumTreeItems);
+  appendScalar(buffer, m_NumChunks);
+  buffer.insert(buffer.end(), m_NodeTable->rawTree.begin(), m_NodeTable->rawTree.begin() + static_cast<size_t>(m_NumTreeItems) * 512);
+
+  // Store the extents of every pointer table, reading any table that has not been needed yet
+  for(size_t i = 1; i < m_NodeTable->nodeCount; i++)
   {
-    if(child.second->isDirectory())
+    const SFSNodeItem* item = &m_NodeTable->nodes[i];
+    const std::vector<SFSNodeItem::ChunkExtent>& chunkExtents = item->getChunkExtents();
+    if(!item->getIsValid())
     {
-      std::string path = outputDir + "/" + child.second->getFileName();
-      SFSUtils::mkdir(path, true);
-      saveFile(path, child.second);
+      return -2;
     }
-    else
+    appendScalar(buffer, static_cast<uint32_t>(chunkExtents.size()));
+    for(size_t e = 0; e < chunkExtents.size(); e++)
     {
-      std::string outputPath = outputDir + "/" + child.second->getFileName();
-      std::cout << "Saving File: " << outputPath << std::endl;
-      err = child.second->writeFile(outputPath);
+      uint64_t endChunk = e + 1 < chunkExtents.size() ? chunkExtents[e + 1].firstChunk : static_cast<uint64_t>(item->getChunkCount());
+      appendScalar(buffer, chunkExtents[e].filePos);
+      appendScalar(buffer, static_cast<uint32_t>(endChunk - chunkExtents[e].firstChunk));
     }
   }
+
+  // Write to a temporary file first so a concurrent reader never sees a half written index
+  std::string indexPath = getIndexFilePath();
+  std::string tempPath = indexPath + ".tmp";
+  FILE* fout = fopen(tempPath.c_str(), "wb");
+  if(nullptr == fout)
+  {
+    std::cout << "Could not write index file '" << indexPath << "'" << std::endl;
+    return -3;
+  }
+  size_t nwritten = fwrite(buffer.data(), 1, buffer.size(), fout);
+  int closeErr = fclose(fout);
+  if(nwritten != buffer.size() || closeErr != 0)
+  {
+    std::remove(tempPath.c_str());
+    std::cout << "Could not write index file '" << indexPath << "'" << std::endl;
+    return -4;
+  }
+#if defined(_WIN32)
+  std::remove(indexPath.c_str());
+#endif
+  if(std::rename(tempPath.c_str(), indexPath.c_str()) != 0)
+  {
+    std::remove(tempPath.c_str());
+    std::cout << "Could not write index file '" << indexPath << "'" << std::endl;
+    return -5;
+  }
+  return 0;
 }
 
 // -----------------------------------------------------------------------------
-void SFSReader::extractAll(const std::string& outputPath) const
+int32_t SFSReader::extractAll(const std::string& outputPath, size_t threadCount) const
 {
+  if(m_NodeTable == nullptr)
+  {
+    return -1;
+  }
+  const SFSNodeItem* rootNode = &m_NodeTable->nodes[0];
   SFSUtils::mkdir(outputPath, true);
-  saveFile(outputPath, m_RootNode);
+
+  // Create the complete directory skeleton up front so the workers only ever create files
+  std::vector<std::pair<std::string, const SFSNodeItem*>> files;
+  collectFiles(outputPath, rootNode, files);
+
+  uint64_t totalBytes = 0;
+  for(const auto& file : files)
+  {
+    totalBytes += file.second->getUncompressedSize();
+  }
+  if(m_UseSweepExtraction && !isCompressed())
+  {
+    SFSConsoleProgress console;
+    SFSProgressReporter sweepProgress(m_ProgressObserver != nullptr ? m_ProgressObserver : &console, "Extracting " + m_FilePath, totalBytes);
+    int32_t err = sweepFiles(files, sweepProgress);
+    sweepProgress.finish();
+    return err;
+  }
+
+  SFSProgressReporter progress(m_ProgressObserver, "Extracting " + m_FilePath, totalBytes);
+
+  // Without an observer every file prints its own name and, when written on its own, its own progress
+  std::mutex consoleMutex;
+  std::atomic<int32_t> result = 0;
+  auto writeFile = [this, &progress, &consoleMutex, &result](const std::pair<std::string, const SFSNodeItem*>& file, bool showProgress, size_t fileThreadCount) {
+    if(progress.isCanceled())
+    {
+      result = SFSProgressObserver::k_CanceledError;
+      return;
+    }
+    int32_t err = 0;
+    if(m_ProgressObserver != nullptr)
+    {
+      err = file.second->writeFile(file.first, progress, fileThreadCount);
+    }
+    else
+    {
+      {
+        std::lock_guard<std::mutex> lock(consoleMutex);
+        std::cout << "Saving File: " << file.first << std::endl;
+      }
+      err = file.second->writeFile(file.first, showProgress, fileThreadCount);
+    }
+    if(err == SFSProgressObserver::k_CanceledError)
+    {
+      result = err;
+    }
+    else if(err < -1)
+    {
+      // -1 only means the file is empty
+      result = err;
+      std::lock_guard<std::mutex> lock(consoleMutex);
+      std::cout << "Error " << err << " writing file: " << file.first << std::endl;
+    }
+  };
+
+  if(threadCount <= 1)
+  {
+    for(const auto& file : files)
+    {
+      writeFile(file, true, 1);
+    }
+    progress.finish();
+    return result;
+  }
+
+  // Largest files first so that a big file picked up last does not leave the other workers idle
+  std::stable_sort(files.begin(), files.end(), [](const auto& a, const auto& b) { return a.second->getUncompressedSize() > b.second->getUncompressedSize(); });
+
+  // Files big enough to keep every thread busy on their own are copied one at a time, each split
+  // into ranges that are copied concurrently.
+  auto firstSmallFile = files.begin();
+  while(firstSmallFile != files.end() && firstSmallFile->second->getUncompressedSize() >= threadCount * SFSNodeItem::k_MinRangeBytes)
+  {
+    writeFile(*firstSmallFile, true, threadCount);
+    ++firstSmallFile;
+  }
+
+  ThreadPool pool(std::min<size_t>(threadCount, std::distance(firstSmallFile, files.end())));
+  for(auto iter = firstSmallFile; iter != files.end(); ++iter)
+  {
+    const auto& file = *iter;
+    pool.enqueue([&writeFile, &file]() { writeFile(file, false, 1); });
+  }
+  pool.waitForAll();
+  progress.finish();
+  return result;
 }
 
 // -----------------------------------------------------------------------------
-std::vector<std::string> split(const std::string& s, char delimiter)
+int32_t SFSReader::sweepFiles(const std::vector<std::pair<std::string, const SFSNodeItem*>>& files, SFSProgressReporter& progress) const
 {
-  std::vector<std::string> tokens;
-  std::string token;
-  std::istringstream tokenStream(s);
-  while(std::getline(tokenStream, token, delimiter))
+  // A run of chunks of one file that sit one chunk size apart in the container
+  struct SweepSegment
+  {
+    uint64_t filePos = 0; // Container position of the payload of the first chunk
+    size_t fileIndex = 0;
+    uint64_t firstChunk = 0;
+    uint64_t chunkCount = 0;
+  };
+  // A single read that covers one or more segments
+  struct SweepWindow
+  {
+    uint64_t start = 0;
+    uint64_t end = 0;
+    size_t firstSegment = 0;
+    size_t endSegment = 0;
+  };
+
+  const uint64_t chunkSize = getChunkSize();
+  const uint64_t usableChunkSize = getUsableChunkSize();
+  const uint64_t maxSegmentChunks = std::max<uint64_t>(k_SweepWindowBytes / chunkSize, 1);
+  auto segmentEnd = [&files, chunkSize, usableChunkSize](const SweepSegment& segment) {
+    const uint64_t fileSize = files[segment.fileIndex].second->getFileSize();
+    const uint64_t lastChunk = segment.firstChunk + segment.chunkCount - 1;
+    return segment.filePos + (segment.chunkCount - 1) * chunkSize + std::min(usableChunkSize, fileSize - lastChunk * usableChunkSize);
+  };
+
+  // Split every pointer table into segments, no longer than a window, and put them in container order
+  int32_t result = 0;
+  std::vector<SweepSegment> segments;
+  std::vector<size_t> remainingSegments(files.size(), 0);
+  for(size_t fileIndex = 0; fileIndex < files.size(); fileIndex++)
+  {
+    const SFSNodeItem* node = files[fileIndex].second;
+    if(node->getFileSize() == 0)
+    {
+      continue;
+    }
+    const std::vector<SFSNodeItem::ChunkExtent>& extents = node->getChunkExtents();
+    if(!node->getIsValid() || extents.empty())
+    {
+      std::cout << "Error -4 writing file: " << files[fileIndex].first << std::endl;
+      result = -4;
+      continue;
+    }
+    for(size_t e = 0; e < extents.size(); e++)
+    {
+      const uint64_t runEnd = e + 1 < extents.size() ? extents[e + 1].firstChunk : static_cast<uint64_t>(node->getChunkCount());
+      for(uint64_t chunk = extents[e].firstChunk; chunk < runEnd; chunk += maxSegmentChunks)
+      {
+        SweepSegment segment;
+        segment.filePos = extents[e].filePos + (chunk - extents[e].firstChunk) * chunkSize;
+        segment.fileIndex = fileIndex;
+        segment.firstChunk = chunk;
+        segment.chunkCount = std::min(maxSegmentChunks, runEnd - chunk);
+        segments.push_back(segment);
+        remainingSegments[fileIndex]++;
+      }
+    }
+  }
+  std::sort(segments.begin(), segments.end(), [](const SweepSegment& a, const SweepSegment& b) { return a.filePos < b.filePos; });
+
+  // Neighbouring segments are read together as long as the gap between them is small
+  std::vector<SweepWindow> windows;
+  for(size_t s = 0; s < segments.size(); s++)
+  {
+    const uint64_t start = segments[s].filePos;
+    const uint64_t end = segmentEnd(segments[s]);
+    if(!windows.empty())
+    {
+      SweepWindow& last = windows.back();
+      if(start >= last.end && start - last.end <= k_MaxSweepGapBytes && end - last.start <= k_SweepWindowBytes)
+      {
+        last.end = end;
+        last.endSegment = s + 1;
+        continue;
+      }
+    }
+    windows.push_back({start, end, s, s + 1});
+  }
+
+  // The outputs are opened when their first segment comes by and closed after their last one
+  std::vector<SFSUtils::FileHandle> outputs(files.size(), SFSUtils::k_InvalidFileHandle);
+  std::vector<bool> failed(files.size(), false);
+  const bool directIO = getUseDirectIO();
+
+  // Drops the chunk headers from the segments of a window and writes each payload in place
+  auto scatterWindow = [&](const SweepWindow& window, uint8_t* data) {
+    int32_t err = 0;
+    for(size_t s = window.firstSegment; s < window.endSegment; s++)
+    {
+      const SweepSegment& segment = segments[s];
+      const size_t fileIndex = segment.fileIndex;
+      const SFSNodeItem* node = files[fileIndex].second;
+      if(!failed[fileIndex] && outputs[fileIndex] == SFSUtils::k_InvalidFileHandle)
+      {
+        outputs[fileIndex] = SFSUtils::openFileForWriting(files[fileIndex].first);
+        if(outputs[fileIndex] == SFSUtils::k_InvalidFileHandle || !SFSUtils::resizeFile(outputs[fileIndex], node->getFileSize()))
+        {
+          std::cout << "Error -3 writing file: " << files[fileIndex].first << std::endl;
+          failed[fileIndex] = true;
+          err = -3;
+        }
+      }
+      if(!failed[fileIndex])
+      {
+        uint8_t* payload = data + (segment.filePos - window.start);
+        const uint64_t length = segmentEnd(segment) - segment.filePos - (segment.chunkCount - 1) * (chunkSize - usableChunkSize);
+        for(uint64_t c = 1; c < segment.chunkCount; c++)
+        {
+          std::memmove(payload + c * usableChunkSize, payload + c * chunkSize, std::min(usableChunkSize, length - c * usableChunkSize));
+        }
+        const uint64_t fileOffset = segment.firstChunk * usableChunkSize;
+        if(SFSUtils::writeAt(outputs[fileIndex], fileOffset, length, payload) != static_cast<int64_t>(length))
+        {
+          std::cout << "Error -6 writing file: " << files[fileIndex].first << std::endl;
+          failed[fileIndex] = true;
+          err = -6;
+        }
+        else if(directIO)
+        {
+          SFSUtils::dropCachedRange(outputs[fileIndex], fileOffset, length);
+        }
+        progress.add(length);
+      }
+      if(--remainingSegments[fileIndex] == 0 && outputs[fileIndex] != SFSUtils::k_InvalidFileHandle)
+      {
+        SFSUtils::closeFile(outputs[fileIndex]);
+        outputs[fileIndex] = SFSUtils::k_InvalidFileHandle;
+      }
+    }
+    return err;
+  };
+
+  // Read one window while the previous one is being written
+  std::array<std::vector<uint8_t>, 2> buffers;
+  size_t current = 0;
+  std::future<int32_t> pendingScatter;
+  for(size_t w = 0; w < windows.size(); w++)
+  {
+    if(progress.isCanceled())
+    {
+      result = SFSProgressObserver::k_CanceledError;
+      break;
+    }
+    if(w + 1 < windows.size() && getPrefetchWindow() > 0)
+    {
+      adviseWillNeed(windows[w + 1].start, windows[w + 1].end - windows[w + 1].start);
+    }
+    const SweepWindow& window = windows[w];
+    std::vector<uint8_t>& data = buffers[current];
+    data.resize(std::max<size_t>(data.size(), window.end - window.start));
+    const bool readOk = (readRaw(window.start, window.end - window.start, data.data()) == static_cast<int64_t>(window.end - window.start));
+    if(pendingScatter.valid())
+    {
+      int32_t err = pendingScatter.get();
+      result = err < 0 ? err : result;
+    }
+    if(!readOk)
+    {
+      // Every file with a segment in this window would be left incomplete, so it is removed instead
+      std::cout << "Not Enough Bytes Read: " << window.start << " Needed " << window.end - window.start << " bytes" << std::endl;
+      result = -5;
+      for(size_t s = window.firstSegment; s < window.endSegment; s++)
+      {
+        const size_t fileIndex = segments[s].fileIndex;
+        if(failed[fileIndex])
+        {
+          continue;
+        }
+        std::cout << "Error -5 writing file: " << files[fileIndex].first << std::endl;
+        failed[fileIndex] = true;
+        if(outputs[fileIndex] != SFSUtils::k_InvalidFileHandle)
+        {
+          SFSUtils::closeFile(outputs[fileIndex]);
+          outputs[fileIndex] = SFSUtils::k_InvalidFileHandle;
+          std::remove(files[fileIndex].first.c_str());
+        }
+      }
+      continue;
+    }
+    pendingScatter = std::async(std::launch::async, scatterWindow, std::cref(window), data.data());
+    current ^= 1;
+  }
+  if(pendingScatter.valid())
   {
-    tokens.push_back(token);
+    int32_t err = pendingScatter.get();
+    result = err < 0 ? err : result;
   }
-  return tokens;
+
+  // Only left open when the sweep was canceled
+  for(SFSUtils::FileHandle output : outputs)
+  {
+    if(output != SFSUtils::k_InvalidFileHandle)
+    {
+      SFSUtils::closeFile(output);
+    }
+  }
+  return result;
 }
 
 // -----------------------------------------------------------------------------
 int32_t SFSReader::extractFile(const std::string& outputPath, const std::string& sfsPath) const
 {
-  SFSUtils::mkdir(outputPath, true);
+  return extractNode(outputPath, sfsPath, true);
+}
 
-  std::vector<std::string> tokens = split(sfsPath, '/');
+// -----------------------------------------------------------------------------
+std::future<int32_t> SFSReader::extractAsync(const std::string& sfsPath, const std::string& outputPath) const
+{
+  return getIoPool().submit([this, sfsPath, outputPath]() { return extractNode(outputPath, sfsPath, false); });
+}
 
-  SFSNodeItemPtr node = m_RootNode;
-  for(const auto& token : tokens)
-  {
-    node = node->child(token);
-    if(node.get() == nullptr)
+// -----------------------------------------------------------------------------
+std::future<std::vector<uint8_t>> SFSReader::readAsync(const std::string& sfsPath) const
+{
+  SFSNodeItemPtr node = findNode(sfsPath);
+  return getIoPool().submit([node]() {
+    std::vector<uint8_t> data;
+    if(node == nullptr || node->isDirectory())
     {
-      break;
+      return data;
     }
-    if(node->isDirectory())
+    data.resize(node->getUncompressedSize());
+    if(node->readData(0, data.size(), data.data()) != static_cast<int64_t>(data.size()))
     {
-      std::string path = outputPath + "/" + node->getFileName();
-      SFSUtils::mkdir(path, true);
+      data.clear();
     }
-  }
+    return data;
+  });
+}
 
+// -----------------------------------------------------------------------------
+int32_t SFSReader::extractNode(const std::string& outputPath, const std::string& sfsPath, bool showProgress) const
+{
+  SFSUtils::mkdir(outputPath, true);
+
+  SFSNodeItemPtr node = findNode(sfsPath);
   if(node.get() == nullptr)
   {
     std::cout << "Path does not exist in SFS file. '" << sfsPath << "'" << std::endl;
     return -10;
   }
+
+  // Create every directory along the path
+  for(size_t slashPos = sfsPath.find('/'); slashPos != std::string::npos; slashPos = sfsPath.find('/', slashPos + 1))
+  {
+    SFSUtils::mkdir(outputPath + "/" + sfsPath.substr(0, slashPos), true);
+  }
+  if(node->isDirectory())
+  {
+    SFSUtils::mkdir(outputPath + "/" + sfsPath, true);
+  }
+
   std::string fullpath = outputPath + "/" + sfsPath;
-  return node->writeFile(fullpath);
+  return node->writeFile(fullpath, showProgress);
 }
 
 // -----------------------------------------------------------------------------
-bool SFSReader::fileExists(const std::string& sfsPath) const
+SFSNodeItemPtr SFSReader::findNode(const std::string& sfsPath) const
 {
-  if(sfsPath.empty())
+  if(m_NodeTable == nullptr)
   {
-    return false;
+    return nullptr;
+  }
+  std::string_view path(sfsPath);
+  while(!path.empty() && path.back() == '/')
+  {
+    path.remove_suffix(1);
+  }
+  if(path.empty())
+  {
+    return nullptr;
   }
-  std::vector<std::string> tokens = split(sfsPath, '/');
 
-  SFSNodeItemPtr node = m_RootNode;
-  for(const auto& token : tokens)
+  const std::vector<uint32_t>& pathSlots = m_NodeTable->pathSlots;
+  const size_t mask = pathSlots.size() - 1;
+  for(size_t slot = hashPath(path) & mask; pathSlots[slot] != 0; slot = (slot + 1) & mask)
   {
-    node = node->child(token);
-    if(nullptr == node.get())
+    if(matchesPath(&m_NodeTable->nodes[pathSlots[slot]], &m_NodeTable->nodes[0], path))
     {
-      return false;
+      return getNode(pathSlots[slot]);
     }
   }
+  return nullptr;
+}
 
-  if(node == m_RootNode)
+// -----------------------------------------------------------------------------
+int64_t SFSReader::readAt(const SFSNodeItem& node, uint64_t offset, uint64_t length, uint8_t* dest) const
+{
+  if(node.isDirectory())
   {
-    return false;
+    return -2;
   }
-  return node.get() != nullptr;
+  return node.readData(offset, length, dest);
+}
+
+// -----------------------------------------------------------------------------
+int64_t SFSReader::readRaw(uint64_t filePos, uint64_t length, uint8_t* dest) const
+{
+  if(m_MappedData != nullptr)
+  {
+    if(filePos >= m_MappedSize)
+    {
+      return 0;
+    }
+    length = std::min(length, m_MappedSize - filePos);
+    ::memcpy(dest, m_MappedData + filePos, static_cast<size_t>(length));
+    return static_cast<int64_t>(length);
+  }
+  if(m_DirectInput)
+  {
+    return SFSUtils::readAtDirect(m_InputHandle, filePos, length, dest);
+  }
+  return SFSUtils::readAt(m_InputHandle, filePos, length, dest);
+}
+
+// -----------------------------------------------------------------------------
+bool SFSReader::fileExists(const std::string& sfsPath) const
+{
+  return findNode(sfsPath) != nullptr;
 }
@@ -20,10 +20,17 @@
 
 #include <cstdint>
 #include <cstdio>
+#include <future>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <utility>
+#include <vector>
 
 class SFSNodeItem;
+class ThreadPool;
+class SFSProgressObserver;
+class SFSProgressReporter;
 using SFSNodeItemPtr = std::shared_ptr<SFSNodeItem>;
 
 /**
@@ -32,6 +39,11 @@ using SFSNodeItemPtr = std::shared_ptr<SFSNodeItem>;
 class SFSReader
 {
 public:
+  static constexpr uint64_t k_DefaultPrefetchWindow = 32 * 1024 * 1024;
+  static constexpr size_t k_DefaultAsyncThreadCount = 4;
+  static constexpr uint64_t k_SweepWindowBytes = 32 * 1024 * 1024;
+  static constexpr uint64_t k_MaxSweepGapBytes = 1024 * 1024;
+
   SFSReader();
   ~SFSReader();
 
@@ -47,6 +59,194 @@ public:
    */
   int parseFile(const std::string& filepath);
 
+  /**
+   * @brief setUseMemoryMap When enabled, parseFile() maps the entire container into memory once
+   * and every member read is served straight out of the mapping instead of a fopen/fseek/fread
+   * per chunk. This must be set before calling parseFile(). If the mapping can not be created the
+   * reader silently falls back to regular file I/O.
+   * @param useMemoryMap
+   */
+  void setUseMemoryMap(bool useMemoryMap);
+
+  /**
+   * @brief getUseMemoryMap
+   * @return
+   */
+  bool getUseMemoryMap() const;
+
+  /**
+   * @brief setUseIoUring When enabled (the default) large members that are not memory mapped are fetched
+   * through an io_uring with many chunk reads in flight at once. This only has an effect when io_uring
+   * support was compiled in and the running kernel supports it, otherwise regular positional reads are used.
+   * @param useIoUring
+   */
+  void setUseIoUring(bool useIoUring);
+
+  /**
+   * @brief getUseIoUring Returns true if io_uring was requested and is available
+   * @return
+   */
+  bool getUseIoUring() const;
+
+  /**
+   * @brief setUseCopyFileRange When enabled, members that are not memory mapped are extracted by letting the
+   * kernel copy each chunk payload straight from the container into the output file with copy_file_range()
+   * instead of reading the chunks into user space buffers first. That is one blocking call per chunk, so it is
+   * only used for containers with chunks of at least 256 KB and when io_uring is not in use. Off by default.
+   * This only has an effect on Linux. If the kernel can not copy between the two files the regular reads and
+   * writes are used.
+   * @param useCopyFileRange
+   */
+  void setUseCopyFileRange(bool useCopyFileRange);
+
+  /**
+   * @brief getUseCopyFileRange
+   * @return
+   */
+  bool getUseCopyFileRange() const;
+
+  /**
+   * @brief setUseDirectIO When enabled, parseFile() opens the container so that member reads bypass the page
+   * cache (O_DIRECT on Linux) and extracted files are written back and dropped from the page cache as they are
+   * written. Converting or extracting a multi GB container then no longer evicts everything else from memory.
+   * Reads are widened to aligned blocks internally, so callers may still read any range. Memory mapping,
+   * io_uring and copy_file_range are not used in this mode. If the file system does not support direct I/O
+   * the reader falls back to regular file I/O. This must be set before calling parseFile().
+   * @param useDirectIO
+   */
+  void setUseDirectIO(bool useDirectIO);
+
+  /**
+   * @brief getUseDirectIO Returns true if direct I/O was requested and the container could be opened that way
+   * @return
+   */
+  bool getUseDirectIO() const;
+
+  /**
+   * @brief setPrefetchWindow Sets how many bytes of a file ahead of the current read position are requested
+   * from the kernel in the background while the file is extracted or streamed. The requests follow the
+   * pointer table of the file, so the read-ahead works for fragmented files too. Use 0 to turn this off.
+   * @param prefetchWindow
+   */
+  void setPrefetchWindow(uint64_t prefetchWindow);
+
+  /**
+   * @brief getPrefetchWindow Returns the prefetch window in bytes. This is 0 when prefetching is off or the
+   * container is read with direct I/O, which never goes through the page cache.
+   * @return
+   */
+  uint64_t getPrefetchWindow() const;
+
+  /**
+   * @brief adviseWillNeed Asks the kernel to start reading the given range of the container into memory
+   * in the background. For a memory mapped container the range of the mapping is advised instead.
+   * @param filePos
+   * @param length
+   */
+  void adviseWillNeed(uint64_t filePos, uint64_t length) const;
+
+  /**
+   * @brief setProgressObserver Sends the progress of extractAll() and SFSNodeItem::writeFile() to 'observer'
+   * instead of std::cout, and lets it cancel them. The reader does not take ownership, so the observer must
+   * outlive the work it watches. Use nullptr to go back to printing to std::cout.
+   * @param observer
+   */
+  void setProgressObserver(SFSProgressObserver* observer);
+
+  /**
+   * @brief getProgressObserver
+   * @return The observer or nullptr if none is set
+   */
+  SFSProgressObserver* getProgressObserver() const;
+
+  /**
+   * @brief setUseSweepExtraction When enabled, extractAll() sorts the chunks of all files by their position in
+   * the container and reads the container in one forward sweep, writing each payload into the file it belongs
+   * to. Files whose chunks are interleaved on disk then no longer make the disk seek back and forth. The thread
+   * count of extractAll() is ignored in this mode and compressed containers are still extracted file by file.
+   * @param useSweepExtraction
+   */
+  void setUseSweepExtraction(bool useSweepExtraction);
+
+  /**
+   * @brief getUseSweepExtraction
+   * @return
+   */
+  bool getUseSweepExtraction() const;
+
+  /**
+   * @brief setAsyncThreadCount Sets the number of threads that run extractAsync() and readAsync() requests.
+   * The threads are started by the first asynchronous request, so this must be called before that.
+   * @param asyncThreadCount
+   */
+  void setAsyncThreadCount(size_t asyncThreadCount);
+
+  /**
+   * @brief getAsyncThreadCount
+   * @return
+   */
+  size_t getAsyncThreadCount() const;
+
+  /**
+   * @brief setUseIndexCache When enabled, parseFile() first tries to load the node table and every member's
+   * pointer table from a small binary index file written by an earlier parse. The index is keyed by the size
+   * and modification time of the container and is ignored (and rewritten) when either changes. Re-opening a
+   * container then costs a single read of the index instead of walking all the tree and pointer table chunks.
+   * This must be set before calling parseFile().
+   * @param useIndexCache
+   */
+  void setUseIndexCache(bool useIndexCache);
+
+  /**
+   * @brief getUseIndexCache
+   * @return
+   */
+  bool getUseIndexCache() const;
+
+  /**
+   * @brief setIndexCacheDirectory Stores index files in the given directory instead of next to the container.
+   * An empty string (the default) writes the index as a '.bcfidx' style sidecar next to the input file.
+   * @param indexCacheDirectory
+   */
+  void setIndexCacheDirectory(const std::string& indexCacheDirectory);
+
+  /**
+   * @brief getIndexCacheDirectory
+   * @return
+   */
+  const std::string& getIndexCacheDirectory() const;
+
+  /**
+   * @brief getIndexFilePath Returns the path of the index file that belongs to the current input file
+   * @return
+   */
+  std::string getIndexFilePath() const;
+
+  /**
+   * @brief getInputHandle Returns the native handle that all positional reads go through
+   * @return
+   */
+  intptr_t getInputHandle() const;
+
+  /**
+   * @brief isMemoryMapped Returns true if the container is currently mapped into memory.
+   * @return
+   */
+  bool isMemoryMapped() const;
+
+  /**
+   * @brief getMappedData Returns the start of the memory mapped container or nullptr if the
+   * container is not mapped.
+   * @return
+   */
+  const uint8_t* getMappedData() const;
+
+  /**
+   * @brief getMappedSize
+   * @return
+   */
+  uint64_t getMappedSize() const;
+
   /**
    * @brief getVersion
    * @return
@@ -65,6 +265,13 @@ public:
    */
   uint32_t getUsableChunkSize() const;
 
+  /**
+   * @brief isCompressed Returns true if the files in the container are stored as zlib compressed blocks.
+   * SFSNodeItem::readData() and SFSNodeItem::writeFile() inflate the files transparently.
+   * @return
+   */
+  bool isCompressed() const;
+
   /**
    * @brief getInputFile
    * @return
@@ -79,9 +286,15 @@ public:
 
   /**
    * @brief extractAll This will extract all files within the SFS file into a designated folder.
+   * The directory tree is created first. With more than one thread the files are then written
+   * by a pool of workers, largest files first. A progress observer receives the bytes of all files
+   * as one stage and may cancel the extraction between two windows of chunks.
    * @param outputPath
+   * @param threadCount Number of files to write at the same time
+   * @return 0, SFSProgressObserver::k_CanceledError if the extraction was canceled or the error of
+   * the last file that could not be written
    */
-  void extractAll(const std::string& outputPath) const;
+  int32_t extractAll(const std::string& outputPath, size_t threadCount = 1) const;
 
   /**
    * @brief extractFile This will extract a specific file within the SFS File
@@ -91,6 +304,24 @@ public:
    */
   int32_t extractFile(const std::string& outputPath, const std::string& sfsPath) const;
 
+  /**
+   * @brief extractAsync Queues extractFile(outputPath, sfsPath) on the reader's I/O threads and returns right
+   * away, so that several files can be extracted at once, for example the small metadata files while FrameData
+   * is still being written. Without a progress observer no progress is printed. Errors are still printed to
+   * std::cout, from the I/O thread.
+   * @param sfsPath
+   * @param outputPath
+   * @return The error code that extractFile() returns
+   */
+  std::future<int32_t> extractAsync(const std::string& sfsPath, const std::string& outputPath) const;
+
+  /**
+   * @brief readAsync Queues a read of the complete (uncompressed) file at 'sfsPath' on the reader's I/O threads
+   * @param sfsPath
+   * @return The contents of the file, or an empty vector if the path is not a file or it could not be read
+   */
+  std::future<std::vector<uint8_t>> readAsync(const std::string& sfsPath) const;
+
   /**
    * @brief Checks if the given path exists in the BCF archive
    * @param sfsPath The path to check
@@ -98,7 +329,114 @@ public:
    */
   bool fileExists(const std::string& sfsPath) const;
 
+  /**
+   * @brief findNode Returns the node at the given path inside the SFS archive. This is a single hash lookup
+   * of the full path.
+   * @param sfsPath The path to find, for example "EBSDData/FrameData"
+   * @return The node or nullptr if the path does not exist
+   */
+  SFSNodeItemPtr findNode(const std::string& sfsPath) const;
+
+  /**
+   * @brief readAt Reads 'length' bytes of the given member starting at 'offset' into 'dest'. The reader
+   * keeps a single descriptor open for the lifetime of the parsed file and uses positional reads
+   * (pread/ReadFile with an explicit offset), so this may be called from many threads at once
+   * without locking or per-thread file handles.
+   * @param node The member to read from
+   * @param offset Byte offset within the member
+   * @param length Number of bytes to read
+   * @param dest Destination buffer of at least 'length' bytes
+   * @return Number of bytes read (less than 'length' only at the end of the member) or a negative error code
+   */
+  int64_t readAt(const SFSNodeItem& node, uint64_t offset, uint64_t length, uint8_t* dest) const;
+
+  /**
+   * @brief readRaw Reads 'length' bytes starting at the absolute container position 'filePos'. Thread safe.
+   * @param filePos
+   * @param length
+   * @param dest
+   * @return Number of bytes read or -1 on error
+   */
+  int64_t readRaw(uint64_t filePos, uint64_t length, uint8_t* dest) const;
+
 private:
+  struct NodeTable;
+
+  /**
+   * @brief parseContainer Reads the SFS header and the raw tree items out of the container
+   * @param rawTreeBuffer Receives the raw 512 byte tree items
+   * @return Error code
+   */
+  int32_t parseContainer(std::vector<uint8_t>& rawTreeBuffer);
+
+  /**
+   * @brief buildNodeTable Creates all nodes in one contiguous table, links them up with their parents and
+   * indexes them by their full path. The table takes ownership of the raw tree items, which the node names
+   * point into.
+   * @param rawTreeBuffer
+   */
+  void buildNodeTable(std::vector<uint8_t> rawTreeBuffer);
+
+  /**
+   * @brief detectCompression Checks the first file that holds any data for the compressed data signature
+   */
+  void detectCompression();
+
+  /**
+   * @brief getNode Returns a pointer to the node at the given index of the node table. The pointer shares
+   * ownership of the complete table.
+   * @param nodeIndex
+   * @return
+   */
+  SFSNodeItemPtr getNode(size_t nodeIndex) const;
+
+  /**
+   * @brief readIndexFile Loads the SFS header values and builds the node table from the index file
+   * @return 0 on success or a negative value if there is no usable index for the current input file
+   */
+  int32_t readIndexFile();
+
+  /**
+   * @brief writeIndexFile Stores the SFS header values, the raw tree items and every pointer table as
+   * runs of consecutive chunks in the index file
+   * @return Error code
+   */
+  int32_t writeIndexFile() const;
+
+  /**
+   * @brief extractNode Writes the file or directory at 'sfsPath' below 'outputPath'
+   * @param outputPath
+   * @param sfsPath
+   * @param showProgress Print the progress of the file to std::cout when no progress observer is set
+   * @return Error code
+   */
+  int32_t extractNode(const std::string& outputPath, const std::string& sfsPath, bool showProgress) const;
+
+  /**
+   * @brief sweepFiles Writes the given files with a single forward sweep over the container
+   * @param files Output path and node of each file
+   * @param progress
+   * @return 0 on success, SFSProgressObserver::k_CanceledError or a negative error code
+   */
+  int32_t sweepFiles(const std::vector<std::pair<std::string, const SFSNodeItem*>>& files, SFSProgressReporter& progress) const;
+
+  /**
+   * @brief getIoPool Returns the threads that run the asynchronous requests, starting them on first use
+   * @return
+   */
+  ThreadPool& getIoPool() const;
+
+  /**
+   * @brief mapFile Maps the input file into memory
+   * @return Error code
+   */
+  int32_t mapFile();
+
+  /**
+   * @brief unmapFile Releases any existing memory mapping
+   */
+  void unmapFile();
+
   std::string m_FilePath;
   bool m_IsValid = false;
 
@@ -109,6 +447,29 @@ private:
   uint32_t m_TreeAddress = 0;
   uint32_t m_NumTreeItems = 0;
   uint32_t m_NumChunks = 0;
+  bool m_Compressed = false;
+
+  std::shared_ptr<NodeTable> m_NodeTable;
+
+  intptr_t m_InputHandle = -1; // Native handle of the input file used for all positional reads
 
-  SFSNodeItemPtr m_RootNode;
+  bool m_UseIoUring = true;
+  bool m_UseCopyFileRange = false;
+  bool m_UseDirectIO = false;
+  bool m_DirectInput = false; // The input handle was opened for direct I/O
+  bool m_UseIndexCache = false;
+  uint64_t m_PrefetchWindow = k_DefaultPrefetchWindow;
+  SFSProgressObserver* m_ProgressObserver = nullptr;
+  size_t m_AsyncThreadCount = k_DefaultAsyncThreadCount;
+  bool m_UseSweepExtraction = false;
+  mutable std::once_flag m_IoPoolStarted;
+  mutable std::unique_ptr<ThreadPool> m_IoPool;
+  std::string m_IndexCacheDirectory;
+  bool m_UseMemoryMap = false;
+  const uint8_t* m_MappedData = nullptr;
+  uint64_t m_MappedSize = 0;
+#if defined(_WIN32)
+  void* m_FileHandle = nullptr;
+  void* m_MappingHandle = nullptr;
+#endif
 };
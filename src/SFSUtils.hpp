@@ -19,8 +19,10 @@
 #pragma once
 
 
+#include <algorithm>
 #include <cstdio>
 #include <cstdint>
+#include <cstring>
 #include <string>
 #include <vector>
 #include <iostream>
@@ -33,7 +35,10 @@
 #define SFS_UTIL_GET_CWD _getcwd
 #else
 #define UNLINK ::unlink
+#include <cerrno>
 #include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
 #define SFS_UTIL_PATH_MAX PATH_MAX
 #define SFS_UTIL_GET_CWD ::getcwd
 #endif
@@ -90,6 +95,9 @@ class SFSUtils
 {
 
   public:
+    static constexpr uint64_t k_MaxIORequest = 1ULL << 30;
+    static constexpr uint64_t k_DirectIOAlignment = 4096;
+    static constexpr uint64_t k_DirectIOBufferBytes = 8 * 1024 * 1024;
 
 
     template <typename T>
@@ -118,6 +126,315 @@ class SFSUtils
     }
 
 
+    /**
+     * @brief Native file handles are passed around as an intptr_t so that headers do not need to pull
+     * in the platform headers. -1 is the invalid value on every platform (INVALID_HANDLE_VALUE on Windows).
+     */
+    using FileHandle = intptr_t;
+    static constexpr FileHandle k_InvalidFileHandle = -1;
+
+    // -----------------------------------------------------------------------------
+    /**
+     * @brief openFileForReading Opens the file at 'path' for reading
+     * @param directIO Bypass the page cache (O_DIRECT, F_NOCACHE or FILE_FLAG_NO_BUFFERING). Reads through a
+     * handle opened this way must go through readAtDirect(). Opening fails if the file system does not allow it.
+     */
+    static FileHandle openFileForReading(const std::string& path, bool directIO = false)
+    {
+#if defined (_WIN32)
+      DWORD flags = directIO ? FILE_FLAG_NO_BUFFERING : FILE_ATTRIBUTE_NORMAL;
+      HANDLE handle = ::CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, flags, nullptr);
+      return reinterpret_cast<FileHandle>(handle);
+#elif defined (__linux__)
+      return static_cast<FileHandle>(::open(path.c_str(), directIO ? O_RDONLY | O_DIRECT : O_RDONLY));
+#else
+      int fd = ::open(path.c_str(), O_RDONLY);
+#if defined (__APPLE__)
+      if(fd >= 0 && directIO && ::fcntl(fd, F_NOCACHE, 1) != 0)
+      {
+        ::close(fd);
+        return k_InvalidFileHandle;
+      }
+#else
+      if(fd >= 0 && directIO)
+      {
+        ::close(fd);
+        return k_InvalidFileHandle;
+      }
+#endif
+      return static_cast<FileHandle>(fd);
+#endif
+    }
+
+    // -----------------------------------------------------------------------------
+    static void closeFile(FileHandle handle)
+    {
+      if(handle == k_InvalidFileHandle)
+      {
+        return;
+      }
+#if defined (_WIN32)
+      ::CloseHandle(reinterpret_cast<HANDLE>(handle));
+#else
+      ::close(static_cast<int>(handle));
+#endif
+    }
+
+    // -----------------------------------------------------------------------------
+    /**
+     * @brief readAt Reads 'length' bytes starting at 'offset' without using or moving a shared file
+     * position so it is safe to call from many threads at once on the same handle.
+     * @return The number of bytes read (short only at the end of the file) or -1 on error
+     */
+    static int64_t readAt(FileHandle handle, uint64_t offset, uint64_t length, void* dest)
+    {
+      auto* destPtr = static_cast<uint8_t*>(dest);
+      uint64_t total = 0;
+      while(total < length)
+      {
+        const uint64_t request = std::min<uint64_t>(length - total, k_MaxIORequest);
+#if defined (_WIN32)
+        OVERLAPPED overlapped = {};
+        overlapped.Offset = static_cast<DWORD>((offset + total) & 0xFFFFFFFFULL);
+        overlapped.OffsetHigh = static_cast<DWORD>((offset + total) >> 32);
+        DWORD numRead = 0;
+        if(::ReadFile(reinterpret_cast<HANDLE>(handle), destPtr + total, static_cast<DWORD>(request), &numRead, &overlapped) == 0)
+        {
+          if(::GetLastError() == ERROR_HANDLE_EOF)
+          {
+            break;
+          }
+          return -1;
+        }
+#else
+        ssize_t numRead = ::pread(static_cast<int>(handle), destPtr + total, static_cast<size_t>(request), static_cast<off_t>(offset + total));
+        if(numRead < 0)
+        {
+          if(errno == EINTR)
+          {
+            continue;
+          }
+          return -1;
+        }
+#endif
+        if(numRead == 0)
+        {
+          break;
+        }
+        total += static_cast<uint64_t>(numRead);
+      }
+      return static_cast<int64_t>(total);
+    }
+
+    // -----------------------------------------------------------------------------
+    /**
+     * @brief readAtDirect Positional read through a handle opened with directIO. The range is widened to
+     * whole k_DirectIOAlignment blocks and read into an aligned per-thread buffer, so neither 'offset',
+     * 'length' nor 'dest' need to be aligned. Requests that already are aligned are read straight into 'dest'.
+     * @return The number of bytes read (short only at the end of the file) or -1 on error
+     */
+    static int64_t readAtDirect(FileHandle handle, uint64_t offset, uint64_t length, void* dest)
+    {
+      auto* destPtr = static_cast<uint8_t*>(dest);
+      const uint64_t mask = k_DirectIOAlignment - 1;
+      if((offset & mask) == 0 && (length & mask) == 0 && (reinterpret_cast<uintptr_t>(destPtr) & mask) == 0)
+      {
+        return readAt(handle, offset, length, destPtr);
+      }
+
+      thread_local std::vector<uint8_t> bounceBuffer;
+      bounceBuffer.resize(k_DirectIOBufferBytes + k_DirectIOAlignment);
+      auto* alignedBuffer = reinterpret_cast<uint8_t*>((reinterpret_cast<uintptr_t>(bounceBuffer.data()) + mask) & ~static_cast<uintptr_t>(mask));
+
+      uint64_t total = 0;
+      while(total < length)
+      {
+        const uint64_t position = offset + total;
+        const uint64_t alignedStart = position & ~mask;
+        const uint64_t lead = position - alignedStart;
+        const uint64_t count = std::min(length - total, k_DirectIOBufferBytes - lead);
+        const uint64_t alignedLength = (lead + count + mask) & ~mask;
+        int64_t numRead = readAt(handle, alignedStart, alignedLength, alignedBuffer);
+        if(numRead < 0)
+        {
+          return -1;
+        }
+        if(static_cast<uint64_t>(numRead) <= lead)
+        {
+          break;
+        }
+        const uint64_t available = std::min(count, static_cast<uint64_t>(numRead) - lead);
+        ::memcpy(destPtr + total, alignedBuffer + lead, static_cast<size_t>(available));
+        total += available;
+        if(available < count)
+        {
+          break;
+        }
+      }
+      return static_cast<int64_t>(total);
+    }
+
+    // -----------------------------------------------------------------------------
+    /**
+     * @brief adviseWillNeed Tells the kernel that the given range of the file will be read soon, so that it
+     * starts reading it into the page cache in the background. Only has an effect on Linux and macOS.
+     */
+    static void adviseWillNeed(FileHandle handle, uint64_t offset, uint64_t length)
+    {
+#if defined (__linux__)
+      ::posix_fadvise(static_cast<int>(handle), static_cast<off_t>(offset), static_cast<off_t>(length), POSIX_FADV_WILLNEED);
+#elif defined (__APPLE__)
+      radvisory advice;
+      advice.ra_offset = static_cast<off_t>(offset);
+      advice.ra_count = static_cast<int>(std::min<uint64_t>(length, INT32_MAX));
+      ::fcntl(static_cast<int>(handle), F_RDADVISE, &advice);
+#else
+      (void)handle;
+      (void)offset;
+      (void)length;
+#endif
+    }
+
+    // -----------------------------------------------------------------------------
+    /**
+     * @brief dropCachedRange Writes back the given range of an output file and tells the kernel that its pages
+     * are not needed anymore, so that large outputs do not push everything else out of the page cache.
+     * A 'length' of 0 means up to the end of the file. Only has an effect on Linux.
+     * @return false on error
+     */
+    static bool dropCachedRange(FileHandle handle, uint64_t offset, uint64_t length)
+    {
+#if defined (__linux__)
+      const int fd = static_cast<int>(handle);
+      const unsigned int flags = SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER;
+      if(::sync_file_range(fd, static_cast<off_t>(offset), static_cast<off_t>(length), flags) != 0)
+      {
+        return false;
+      }
+      return ::posix_fadvise(fd, static_cast<off_t>(offset), static_cast<off_t>(length), POSIX_FADV_DONTNEED) == 0;
+#else
+      (void)handle;
+      (void)offset;
+      (void)length;
+      return true;
+#endif
+    }
+
+    // -----------------------------------------------------------------------------
+    /**
+     * @brief openFileForWriting Creates (or truncates) the file at 'path' for writing
+     */
+    static FileHandle openFileForWriting(const std::string& path)
+    {
+#if defined (_WIN32)
+      HANDLE handle = ::CreateFileA(path.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+      return reinterpret_cast<FileHandle>(handle);
+#else
+      return static_cast<FileHandle>(::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644));
+#endif
+    }
+
+    // -----------------------------------------------------------------------------
+    /**
+     * @brief resizeFile Sets the size of the file so that ranges of it can be written in any order
+     * @return false on error
+     */
+    static bool resizeFile(FileHandle handle, uint64_t size)
+    {
+#if defined (_WIN32)
+      LARGE_INTEGER position;
+      position.QuadPart = static_cast<LONGLONG>(size);
+      return ::SetFilePointerEx(reinterpret_cast<HANDLE>(handle), position, nullptr, FILE_BEGIN) != 0 && ::SetEndOfFile(reinterpret_cast<HANDLE>(handle)) != 0;
+#else
+      return ::ftruncate(static_cast<int>(handle), static_cast<off_t>(size)) == 0;
+#endif
+    }
+
+    // -----------------------------------------------------------------------------
+    /**
+     * @brief writeAt Writes 'length' bytes at 'offset' without using or moving a shared file position
+     * so that different ranges of the same file may be written from many threads at once.
+     * @return The number of bytes written or -1 on error
+     */
+    static int64_t writeAt(FileHandle handle, uint64_t offset, uint64_t length, const void* src)
+    {
+      const auto* srcPtr = static_cast<const uint8_t*>(src);
+      uint64_t total = 0;
+      while(total < length)
+      {
+        const uint64_t request = std::min<uint64_t>(length - total, k_MaxIORequest);
+#if defined (_WIN32)
+        OVERLAPPED overlapped = {};
+        overlapped.Offset = static_cast<DWORD>((offset + total) & 0xFFFFFFFFULL);
+        overlapped.OffsetHigh = static_cast<DWORD>((offset + total) >> 32);
+        DWORD numWritten = 0;
+        if(::WriteFile(reinterpret_cast<HANDLE>(handle), srcPtr + total, static_cast<DWORD>(request), &numWritten, &overlapped) == 0)
+        {
+          return -1;
+        }
+#else
+        ssize_t numWritten = ::pwrite(static_cast<int>(handle), srcPtr + total, static_cast<size_t>(request), static_cast<off_t>(offset + total));
+        if(numWritten < 0)
+        {
+          if(errno == EINTR)
+          {
+            continue;
+          }
+          return -1;
+        }
+#endif
+        if(numWritten == 0)
+        {
+          return -1;
+        }
+        total += static_cast<uint64_t>(numWritten);
+      }
+      return static_cast<int64_t>(total);
+    }
+
+    // -----------------------------------------------------------------------------
+    /**
+     * @brief copyRange Copies 'length' bytes at 'inOffset' of one file to 'outOffset' of another without the
+     * data passing through user space, using copy_file_range(). Neither file position is used or moved, so
+     * different ranges of the same files may be copied from many threads at once. Only available on Linux.
+     * @return The number of bytes copied (short only at the end of the input file) or -1 if the kernel can
+     * not copy between these files. The caller should then fall back to readAt()/writeAt().
+     */
+    static int64_t copyRange(FileHandle inHandle, uint64_t inOffset, FileHandle outHandle, uint64_t outOffset, uint64_t length)
+    {
+#if defined (__linux__)
+      auto inPos = static_cast<loff_t>(inOffset);
+      auto outPos = static_cast<loff_t>(outOffset);
+      uint64_t total = 0;
+      while(total < length)
+      {
+        const uint64_t request = std::min<uint64_t>(length - total, k_MaxIORequest);
+        ssize_t numCopied = ::copy_file_range(static_cast<int>(inHandle), &inPos, static_cast<int>(outHandle), &outPos, static_cast<size_t>(request), 0);
+        if(numCopied < 0)
+        {
+          if(errno == EINTR)
+          {
+            continue;
+          }
+          return -1;
+        }
+        if(numCopied == 0)
+        {
+          break;
+        }
+        total += static_cast<uint64_t>(numCopied);
+      }
+      return static_cast<int64_t>(total);
+#else
+      (void)inHandle;
+      (void)inOffset;
+      (void)outHandle;
+      (void)outOffset;
+      (void)length;
+      return -1;
+#endif
+    }
+
 #if defined (WIN32)
     static  const char Separator = '\\';
 #else
@@ -317,7 +634,8 @@ class SFSUtils
             bool existed = false;
             if (!SFSUtils::isDirPath(chunk, &existed) && !existed)
             {
-              if (!::CreateDirectoryA(chunk.c_str(), 0) ) { return false; }
+              // Another thread may have created it in the meantime
+              if (!::CreateDirectoryA(chunk.c_str(), 0) && ::GetLastError() != ERROR_ALREADY_EXISTS) { return false; }
             }
           }
         }
@@ -352,8 +670,9 @@ class SFSUtils
                   return false;
                 }
               }
-              else if (::mkdir(chunk.c_str(), 0777) != 0)
+              else if (::mkdir(chunk.c_str(), 0777) != 0 && errno != EEXIST)
               {
+                // EEXIST means another thread created it in the meantime
                 return false;
               }
             }
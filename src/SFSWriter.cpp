@@ -0,0 +1,544 @@
+/* ============================================================================
+ * Copyright (c) 2019 BlueQuartz Software, LLC
+ * All rights reserved.
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with any project and source this library is coupled.
+ * If not, see <https://www.gnu.org/licenses/#GPL>.
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+#include "SFSWriter.h"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <iostream>
+#include <limits>
+
+#include <zlib.h>
+
+#include "SFSUtils.hpp"
+
+namespace
+{
+const char k_SFSMagic[8] = {'A', 'A', 'M', 'V', 'H', 'F', 'S', 'S'};
+constexpr uint64_t k_FirstChunkOffset = 280;
+constexpr size_t k_HeaderSize = 0x14C; // The header runs into chunk 0, which is why that chunk is never used
+constexpr uint64_t k_ChunkHeaderSize = 32;
+constexpr uint64_t k_TreeItemSize = 512;
+constexpr size_t k_MaxNameLength = 255;
+constexpr uint32_t k_CompressedSignature = 0x53434141; // "AACS"
+constexpr uint64_t k_CompressedHeaderSize = 0x80;
+constexpr uint64_t k_CompressedBlockHeaderSize = 16;
+
+// -----------------------------------------------------------------------------
+template <typename T>
+void putScalar(uint8_t* dest, size_t offset, T value)
+{
+  ::memcpy(dest + offset, &value, sizeof(T));
+}
+} // namespace
+
+// -----------------------------------------------------------------------------
+SFSWriter::SFSWriter() = default;
+
+// -----------------------------------------------------------------------------
+SFSWriter::~SFSWriter()
+{
+  if(m_OutputHandle != SFSUtils::k_InvalidFileHandle)
+  {
+    close();
+  }
+}
+
+// -----------------------------------------------------------------------------
+void SFSWriter::setChunkSize(uint32_t chunkSize)
+{
+  m_ChunkSize = std::max(chunkSize, k_MinChunkSize);
+}
+
+// -----------------------------------------------------------------------------
+uint32_t SFSWriter::getChunkSize() const
+{
+  return m_ChunkSize;
+}
+
+// -----------------------------------------------------------------------------
+void SFSWriter::setFragmentation(double fragmentation)
+{
+  m_Fragmentation = std::clamp(fragmentation, 0.0, 1.0);
+}
+
+// -----------------------------------------------------------------------------
+double SFSWriter::getFragmentation() const
+{
+  return m_Fragmentation;
+}
+
+// -----------------------------------------------------------------------------
+void SFSWriter::setSeed(uint64_t seed)
+{
+  m_Seed = seed;
+}
+
+// -----------------------------------------------------------------------------
+void SFSWriter::setCompressedBlockSize(uint32_t blockSize)
+{
+  m_CompressedBlockSize = blockSize;
+}
+
+// -----------------------------------------------------------------------------
+uint32_t SFSWriter::getCompressedBlockSize() const
+{
+  return m_CompressedBlockSize;
+}
+
+// -----------------------------------------------------------------------------
+void SFSWriter::setVersion(float version)
+{
+  m_Version = version;
+}
+
+// -----------------------------------------------------------------------------
+int32_t SFSWriter::open(const std::string& filepath)
+{
+  if(m_OutputHandle != SFSUtils::k_InvalidFileHandle)
+  {
+    close();
+  }
+  m_FilePath = filepath;
+  m_OutputHandle = SFSUtils::openFileForWriting(m_FilePath);
+  if(m_OutputHandle == SFSUtils::k_InvalidFileHandle)
+  {
+    std::cout << "Error creating file '" << m_FilePath << "'" << std::endl;
+    return -1;
+  }
+  m_Random.seed(m_Seed);
+  m_NextChunk = 1;
+  m_FreeChunks.clear();
+  m_TreeItems.clear();
+  m_Directories.clear();
+  m_CurrentItem = -1;
+  m_CurrentChunks.clear();
+  m_ChunkFill = 0;
+  m_Run.clear();
+  m_Block.clear();
+  m_BlockCount = 0;
+  return 0;
+}
+
+// -----------------------------------------------------------------------------
+int32_t SFSWriter::addItem(const std::string& sfsPath, bool directory)
+{
+  int32_t parent = -1;
+  size_t start = 0;
+  while(start < sfsPath.size())
+  {
+    size_t end = std::min(sfsPath.find('/', start), sfsPath.size());
+    std::string name = sfsPath.substr(start, end - start);
+    const bool last = (end == sfsPath.size());
+    start = end + 1;
+    if(name.empty())
+    {
+      continue;
+    }
+    if(name.size() > k_MaxNameLength)
+    {
+      std::cout << "SFSWriter: The name '" << name << "' is longer than " << k_MaxNameLength << " characters" << std::endl;
+      return -2;
+    }
+
+    const std::string path = sfsPath.substr(0, end);
+    auto iter = m_Directories.find(path);
+    if(iter != m_Directories.end())
+    {
+      if(last && !directory)
+      {
+        std::cout << "SFSWriter: '" << path << "' already exists as a directory" << std::endl;
+        return -3;
+      }
+      parent = iter->second;
+      continue;
+    }
+    if(m_TreeItems.size() >= static_cast<size_t>(std::numeric_limits<int32_t>::max()))
+    {
+      return -4;
+    }
+    TreeItem item;
+    item.name = name;
+    item.parent = parent;
+    item.directory = directory || !last;
+    m_TreeItems.push_back(item);
+    parent = static_cast<int32_t>(m_TreeItems.size() - 1);
+    if(item.directory)
+    {
+      m_Directories[path] = parent;
+    }
+  }
+  return parent;
+}
+
+// -----------------------------------------------------------------------------
+int32_t SFSWriter::addDirectory(const std::string& sfsPath)
+{
+  return addDirectory(sfsPath, ItemAttributes());
+}
+
+// -----------------------------------------------------------------------------
+int32_t SFSWriter::addDirectory(const std::string& sfsPath, const ItemAttributes& attributes)
+{
+  if(m_OutputHandle == SFSUtils::k_InvalidFileHandle)
+  {
+    return -1;
+  }
+  int32_t itemIndex = addItem(sfsPath, true);
+  if(itemIndex < 0)
+  {
+    return itemIndex;
+  }
+  m_TreeItems[itemIndex].attributes = attributes;
+  return 0;
+}
+
+// -----------------------------------------------------------------------------
+int32_t SFSWriter::beginFile(const std::string& sfsPath)
+{
+  return beginFile(sfsPath, ItemAttributes());
+}
+
+// -----------------------------------------------------------------------------
+int32_t SFSWriter::beginFile(const std::string& sfsPath, const ItemAttributes& attributes)
+{
+  if(m_OutputHandle == SFSUtils::k_InvalidFileHandle)
+  {
+    return -1;
+  }
+  if(m_CurrentItem >= 0)
+  {
+    int32_t err = endFile();
+    if(err < 0)
+    {
+      return err;
+    }
+  }
+  int32_t itemIndex = addItem(sfsPath, false);
+  if(itemIndex < 0)
+  {
+    return itemIndex;
+  }
+  m_CurrentItem = itemIndex;
+  m_TreeItems[itemIndex].attributes = attributes;
+  m_CurrentChunks.clear();
+  m_ChunkFill = 0;
+  m_Block.clear();
+  m_BlockCount = 0;
+  return 0;
+}
+
+// -----------------------------------------------------------------------------
+uint32_t SFSWriter::allocateChunk()
+{
+  if(m_Fragmentation > 0.0 && std::uniform_real_distribution<double>(0.0, 1.0)(m_Random) < m_Fragmentation)
+  {
+    // Either fill a gap that an earlier jump left behind or jump ahead and leave a new gap
+    if(!m_FreeChunks.empty() && (m_Random() & 1) != 0)
+    {
+      size_t index = static_cast<size_t>(m_Random() % m_FreeChunks.size());
+      uint32_t chunk = m_FreeChunks[index];
+      m_FreeChunks[index] = m_FreeChunks.back();
+      m_FreeChunks.pop_back();
+      return chunk;
+    }
+    const uint32_t gap = 1 + static_cast<uint32_t>(m_Random() % k_MaxGapChunks);
+    for(uint32_t g = 0; g < gap; g++)
+    {
+      m_FreeChunks.push_back(m_NextChunk++);
+    }
+  }
+  return m_NextChunk++;
+}
+
+// -----------------------------------------------------------------------------
+int32_t SFSWriter::flushRun()
+{
+  if(m_Run.empty())
+  {
+    return 0;
+  }
+  const uint64_t filePos = k_FirstChunkOffset + static_cast<uint64_t>(m_RunFirstChunk) * m_ChunkSize;
+  int64_t numWritten = SFSUtils::writeAt(m_OutputHandle, filePos, m_Run.size(), m_Run.data());
+  const bool ok = (numWritten == static_cast<int64_t>(m_Run.size()));
+  m_Run.clear();
+  if(!ok)
+  {
+    std::cout << "SFSWriter: Error writing to '" << m_FilePath << "'" << std::endl;
+    return -5;
+  }
+  return 0;
+}
+
+// -----------------------------------------------------------------------------
+int32_t SFSWriter::write(const void* data, uint64_t length)
+{
+  if(m_CurrentItem < 0)
+  {
+    return -1;
+  }
+  const auto* source = static_cast<const uint8_t*>(data);
+  if(m_CompressedBlockSize == 0)
+  {
+    return writeStored(source, length);
+  }
+
+  // Empty files stay empty, everything else starts with room for the compressed data header
+  if(length > 0 && m_TreeItems[m_CurrentItem].size == 0)
+  {
+    const std::vector<uint8_t> header(k_CompressedHeaderSize, 0);
+    int32_t err = writeStored(header.data(), header.size());
+    if(err < 0)
+    {
+      return err;
+    }
+  }
+  while(length > 0)
+  {
+    const uint64_t count = std::min<uint64_t>(length, m_CompressedBlockSize - m_Block.size());
+    m_Block.insert(m_Block.end(), source, source + count);
+    source += count;
+    length -= count;
+    if(m_Block.size() == m_CompressedBlockSize)
+    {
+      int32_t err = flushBlock();
+      if(err < 0)
+      {
+        return err;
+      }
+    }
+  }
+  return 0;
+}
+
+// -----------------------------------------------------------------------------
+int32_t SFSWriter::flushBlock()
+{
+  if(m_Block.empty())
+  {
+    return 0;
+  }
+  uLongf compressedSize = ::compressBound(static_cast<uLong>(m_Block.size()));
+  m_CompressedBlock.resize(k_CompressedBlockHeaderSize + compressedSize);
+  if(::compress(m_CompressedBlock.data() + k_CompressedBlockHeaderSize, &compressedSize, m_Block.data(), static_cast<uLong>(m_Block.size())) != Z_OK)
+  {
+    std::cout << "SFSWriter: Error compressing a block of '" << m_TreeItems[m_CurrentItem].name << "'" << std::endl;
+    return -6;
+  }
+  // Block header: compressed size, uncompressed size, unknown, compressed size including the header
+  putScalar<uint32_t>(m_CompressedBlock.data(), 0, static_cast<uint32_t>(compressedSize));
+  putScalar<uint32_t>(m_CompressedBlock.data(), 4, static_cast<uint32_t>(m_Block.size()));
+  putScalar<uint32_t>(m_CompressedBlock.data(), 8, 0);
+  putScalar<uint32_t>(m_CompressedBlock.data(), 12, static_cast<uint32_t>(compressedSize + k_CompressedBlockHeaderSize));
+  m_BlockCount++;
+  m_Block.clear();
+  return writeStored(m_CompressedBlock.data(), k_CompressedBlockHeaderSize + compressedSize);
+}
+
+// -----------------------------------------------------------------------------
+int32_t SFSWriter::writeCompressedHeader()
+{
+  // Header: signature, uncompressed size of a full block, unknown, number of blocks. It always fits in the first chunk.
+  std::array<uint32_t, 4> header = {k_CompressedSignature, m_CompressedBlockSize, 0, m_BlockCount};
+  const uint64_t filePos = k_FirstChunkOffset + static_cast<uint64_t>(m_CurrentChunks.front()) * m_ChunkSize + k_ChunkHeaderSize;
+  if(SFSUtils::writeAt(m_OutputHandle, filePos, sizeof(header), header.data()) != static_cast<int64_t>(sizeof(header)))
+  {
+    std::cout << "SFSWriter: Error writing to '" << m_FilePath << "'" << std::endl;
+    return -5;
+  }
+  return 0;
+}
+
+// -----------------------------------------------------------------------------
+int32_t SFSWriter::writeStored(const uint8_t* data, uint64_t length)
+{
+  const uint64_t usableChunkSize = m_ChunkSize - k_ChunkHeaderSize;
+  while(length > 0)
+  {
+    if(m_CurrentChunks.empty() || m_ChunkFill == usableChunkSize)
+    {
+      // Consecutive chunks are gathered into one run so they go out with a single write
+      const uint32_t chunk = allocateChunk();
+      const uint64_t runChunks = m_Run.size() / m_ChunkSize;
+      if(runChunks > 0 && (chunk != m_RunFirstChunk + runChunks || m_Run.size() + m_ChunkSize > k_MaxRunBytes))
+      {
+        int32_t err = flushRun();
+        if(err < 0)
+        {
+          return err;
+        }
+      }
+      if(m_Run.empty())
+      {
+        m_RunFirstChunk = chunk;
+      }
+      m_Run.resize(m_Run.size() + m_ChunkSize, 0);
+      m_CurrentChunks.push_back(chunk);
+      m_ChunkFill = 0;
+    }
+    const uint64_t count = std::min(length, usableChunkSize - m_ChunkFill);
+    ::memcpy(m_Run.data() + m_Run.size() - usableChunkSize + m_ChunkFill, data, count);
+    m_ChunkFill += count;
+    m_TreeItems[m_CurrentItem].size += count;
+    data += count;
+    length -= count;
+  }
+  return 0;
+}
+
+// -----------------------------------------------------------------------------
+int32_t SFSWriter::writeChain(const uint8_t* data, uint64_t length, uint64_t bytesPerChunk, uint32_t& firstChunk)
+{
+  const size_t chunkCount = static_cast<size_t>(std::max<uint64_t>((length + bytesPerChunk - 1) / bytesPerChunk, 1));
+  std::vector<uint32_t> chain(chunkCount);
+  for(auto& chunk : chain)
+  {
+    chunk = allocateChunk();
+  }
+  firstChunk = chain.front();
+
+  std::vector<uint8_t> buffer(m_ChunkSize);
+  for(size_t i = 0; i < chunkCount; i++)
+  {
+    std::fill(buffer.begin(), buffer.end(), 0);
+    putScalar<uint32_t>(buffer.data(), 0, i + 1 < chunkCount ? chain[i + 1] : 0);
+    const uint64_t offset = i * bytesPerChunk;
+    const uint64_t count = std::min(bytesPerChunk, length - std::min(length, offset));
+    ::memcpy(buffer.data() + k_ChunkHeaderSize, data + offset, count);
+    const uint64_t filePos = k_FirstChunkOffset + static_cast<uint64_t>(chain[i]) * m_ChunkSize;
+    if(SFSUtils::writeAt(m_OutputHandle, filePos, buffer.size(), buffer.data()) != static_cast<int64_t>(buffer.size()))
+    {
+      std::cout << "SFSWriter: Error writing to '" << m_FilePath << "'" << std::endl;
+      return -5;
+    }
+  }
+  return 0;
+}
+
+// -----------------------------------------------------------------------------
+int32_t SFSWriter::endFile()
+{
+  if(m_CurrentItem < 0)
+  {
+    return -1;
+  }
+  int32_t err = flushBlock();
+  if(err == 0)
+  {
+    err = flushRun();
+  }
+  TreeItem& item = m_TreeItems[m_CurrentItem];
+  m_CurrentItem = -1;
+  if(err < 0 || m_CurrentChunks.empty())
+  {
+    return err;
+  }
+  if(m_CompressedBlockSize != 0)
+  {
+    err = writeCompressedHeader();
+    if(err < 0)
+    {
+      return err;
+    }
+  }
+
+  // The pointer table lists the chunk index of every chunk of the file as 32 bit values
+  const uint64_t entriesPerChunk = (m_ChunkSize - k_ChunkHeaderSize) / sizeof(uint32_t);
+  err = writeChain(reinterpret_cast<const uint8_t*>(m_CurrentChunks.data()), m_CurrentChunks.size() * sizeof(uint32_t), entriesPerChunk * sizeof(uint32_t), item.pointerTableInit);
+  m_CurrentChunks.clear();
+  m_CurrentChunks.shrink_to_fit();
+  return err;
+}
+
+// -----------------------------------------------------------------------------
+int32_t SFSWriter::addFile(const std::string& sfsPath, const void* data, uint64_t length)
+{
+  int32_t err = beginFile(sfsPath);
+  if(err < 0)
+  {
+    return err;
+  }
+  err = write(data, length);
+  if(err < 0)
+  {
+    return err;
+  }
+  return endFile();
+}
+
+// -----------------------------------------------------------------------------
+int32_t SFSWriter::close()
+{
+  if(m_OutputHandle == SFSUtils::k_InvalidFileHandle)
+  {
+    return -1;
+  }
+  int32_t err = 0;
+  if(m_CurrentItem >= 0)
+  {
+    err = endFile();
+  }
+
+  // Tree items never straddle two chunks
+  std::vector<uint8_t> rawTree(std::max<size_t>(m_TreeItems.size(), 1) * k_TreeItemSize, 0);
+  for(size_t i = 0; i < m_TreeItems.size(); i++)
+  {
+    const TreeItem& item = m_TreeItems[i];
+    uint8_t* raw = rawTree.data() + i * k_TreeItemSize;
+    putScalar<uint32_t>(raw, 0, item.pointerTableInit);
+    putScalar<uint64_t>(raw, 4, item.size);
+    putScalar<uint64_t>(raw, 12, item.attributes.creationTime);
+    putScalar<uint64_t>(raw, 20, item.attributes.modificationTime);
+    putScalar<uint64_t>(raw, 28, item.attributes.lastAccessTime);
+    putScalar<uint32_t>(raw, 36, item.attributes.permissions);
+    putScalar<int32_t>(raw, 40, item.parent);
+    raw[220] = item.directory ? 1 : 0;
+    ::memcpy(raw + 224, item.name.data(), item.name.size());
+  }
+  const uint64_t itemsPerChunk = (m_ChunkSize - k_ChunkHeaderSize) / k_TreeItemSize;
+  uint32_t treeAddress = 0;
+  if(err == 0)
+  {
+    err = writeChain(rawTree.data(), m_TreeItems.size() * k_TreeItemSize, itemsPerChunk * k_TreeItemSize, treeAddress);
+  }
+
+  std::array<uint8_t, k_HeaderSize> header = {};
+  ::memcpy(header.data(), k_SFSMagic, sizeof(k_SFSMagic));
+  putScalar<float>(header.data(), 0x124, m_Version);
+  putScalar<uint32_t>(header.data(), 0x128, m_ChunkSize);
+  putScalar<uint32_t>(header.data(), 0x140, treeAddress);
+  putScalar<uint32_t>(header.data(), 0x144, static_cast<uint32_t>(m_TreeItems.size()));
+  putScalar<uint32_t>(header.data(), 0x148, m_NextChunk);
+  if(err == 0 && SFSUtils::writeAt(m_OutputHandle, 0, header.size(), header.data()) != static_cast<int64_t>(header.size()))
+  {
+    err = -5;
+  }
+  // Gaps at the end of the container still have to be complete chunks
+  if(err == 0 && !SFSUtils::resizeFile(m_OutputHandle, k_FirstChunkOffset + static_cast<uint64_t>(m_NextChunk) * m_ChunkSize))
+  {
+    err = -5;
+  }
+
+  SFSUtils::closeFile(m_OutputHandle);
+  m_OutputHandle = SFSUtils::k_InvalidFileHandle;
+  m_TreeItems.clear();
+  m_Directories.clear();
+  m_FreeChunks.clear();
+  return err;
+}
@@ -0,0 +1,269 @@
+/* ============================================================================
+ * Copyright (c) 2019 BlueQuartz Software, LLC
+ * All rights reserved.
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with any project and source this library is coupled.
+ * If not, see <https://www.gnu.org/licenses/#GPL>.
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+/**
+ * @brief The SFSWriter class creates SFS containers that SFSReader can read. Files are streamed into the
+ * container one at a time, so containers far larger than memory can be written. The chunks of the files
+ * can optionally be scattered across the container to mimic the fragmentation of real acquisitions.
+ * This is meant for producing reproducible test and benchmark inputs.
+ */
+class SFSWriter
+{
+public:
+  static constexpr uint32_t k_DefaultChunkSize = 4096;
+  static constexpr uint32_t k_MinChunkSize = 544; // A chunk header plus one tree item
+
+  /**
+   * @brief The times and permissions stored with every file and directory
+   */
+  struct ItemAttributes
+  {
+    uint64_t creationTime = 0;
+    uint64_t modificationTime = 0;
+    uint64_t lastAccessTime = 0;
+    uint32_t permissions = 0;
+  };
+
+  SFSWriter();
+  ~SFSWriter();
+
+  SFSWriter(const SFSWriter&) = delete;            // Copy Constructor Not Implemented
+  SFSWriter(SFSWriter&&) = delete;                 // Move Constructor Not Implemented
+  SFSWriter& operator=(const SFSWriter&) = delete; // Copy Assignment Not Implemented
+  SFSWriter& operator=(SFSWriter&&) = delete;      // Move Assignment Not Implemented
+
+  /**
+   * @brief setChunkSize Sets the size of every chunk, including its 32 byte header. Must be set before open().
+   * @param chunkSize
+   */
+  void setChunkSize(uint32_t chunkSize);
+
+  /**
+   * @brief getChunkSize
+   * @return
+   */
+  uint32_t getChunkSize() const;
+
+  /**
+   * @brief setFragmentation Sets the fraction of chunk allocations that do not simply take the next chunk.
+   * Such an allocation either jumps ahead and leaves a gap or fills a gap left earlier, so 0 writes every
+   * file as one run of consecutive chunks and 1 scatters the chunks of every file. Must be set before open().
+   * @param fragmentation A value between 0 and 1
+   */
+  void setFragmentation(double fragmentation);
+
+  /**
+   * @brief getFragmentation
+   * @return
+   */
+  double getFragmentation() const;
+
+  /**
+   * @brief setSeed Seeds the random layout of fragmented containers. Must be set before open().
+   * @param seed
+   */
+  void setSeed(uint64_t seed);
+
+  /**
+   * @brief setCompressedBlockSize Stores every file as an "AACS" compressed member: a 0x80 byte header
+   * followed by independent zlib blocks that each hold 'blockSize' bytes of the file. 0 writes the files
+   * uncompressed. Must be set before open().
+   * @param blockSize
+   */
+  void setCompressedBlockSize(uint32_t blockSize);
+
+  /**
+   * @brief getCompressedBlockSize
+   * @return
+   */
+  uint32_t getCompressedBlockSize() const;
+
+  /**
+   * @brief setVersion Sets the SFS version stored in the header
+   * @param version
+   */
+  void setVersion(float version);
+
+  /**
+   * @brief open Creates (or truncates) the container
+   * @param filepath
+   * @return Error code
+   */
+  int32_t open(const std::string& filepath);
+
+  /**
+   * @brief addDirectory Adds a directory. Parent directories are added as needed.
+   * @param sfsPath The path inside the container, for example "EBSDData"
+   * @return Error code
+   */
+  int32_t addDirectory(const std::string& sfsPath);
+
+  /**
+   * @brief addDirectory Adds a directory, or updates an existing one, with the given attributes
+   * @param sfsPath
+   * @param attributes
+   * @return Error code
+   */
+  int32_t addDirectory(const std::string& sfsPath, const ItemAttributes& attributes);
+
+  /**
+   * @brief beginFile Starts a new file. Its contents are appended with write() until endFile() is called.
+   * Parent directories are added as needed.
+   * @param sfsPath The path inside the container, for example "EBSDData/FrameData"
+   * @return Error code
+   */
+  int32_t beginFile(const std::string& sfsPath);
+
+  /**
+   * @brief beginFile Starts a new file with the given attributes
+   * @param sfsPath
+   * @param attributes
+   * @return Error code
+   */
+  int32_t beginFile(const std::string& sfsPath, const ItemAttributes& attributes);
+
+  /**
+   * @brief write Appends 'length' bytes to the current file
+   * @param data
+   * @param length
+   * @return Error code
+   */
+  int32_t write(const void* data, uint64_t length);
+
+  /**
+   * @brief endFile Finishes the current file and writes its pointer table
+   * @return Error code
+   */
+  int32_t endFile();
+
+  /**
+   * @brief addFile Writes a complete file in one go
+   * @param sfsPath
+   * @param data
+   * @param length
+   * @return Error code
+   */
+  int32_t addFile(const std::string& sfsPath, const void* data, uint64_t length);
+
+  /**
+   * @brief close Writes the file tree and the header and closes the container
+   * @return Error code
+   */
+  int32_t close();
+
+private:
+  struct TreeItem
+  {
+    std::string name;
+    int32_t parent = -1;
+    bool directory = false;
+    uint64_t size = 0;
+    uint32_t pointerTableInit = 0;
+    ItemAttributes attributes;
+  };
+
+  /**
+   * @brief addItem Adds a tree item below the directory holding 'sfsPath', adding the directories on the way
+   * @param sfsPath
+   * @param directory
+   * @return The index of the new item or a negative error code
+   */
+  int32_t addItem(const std::string& sfsPath, bool directory);
+
+  /**
+   * @brief allocateChunk Returns the index of the chunk to write next, honouring the fragmentation setting
+   * @return
+   */
+  uint32_t allocateChunk();
+
+  /**
+   * @brief flushRun Writes the buffered run of consecutive chunks to the container
+   * @return Error code
+   */
+  int32_t flushRun();
+
+  /**
+   * @brief writeStored Appends 'length' bytes to the chunks of the current file as they are stored in the container
+   * @param data
+   * @param length
+   * @return Error code
+   */
+  int32_t writeStored(const uint8_t* data, uint64_t length);
+
+  /**
+   * @brief flushBlock Compresses the buffered part of the current file into one block and appends it
+   * @return Error code
+   */
+  int32_t flushBlock();
+
+  /**
+   * @brief writeCompressedHeader Fills in the compressed data header at the start of the current file
+   * once the number of blocks is known
+   * @return Error code
+   */
+  int32_t writeCompressedHeader();
+
+  /**
+   * @brief writeChain Writes 'data' into a linked chain of chunks, 'bytesPerChunk' bytes per chunk. The
+   * header of every chunk holds the index of the next chunk of the chain.
+   * @param data
+   * @param length
+   * @param bytesPerChunk
+   * @param firstChunk Set to the index of the first chunk of the chain
+   * @return Error code
+   */
+  int32_t writeChain(const uint8_t* data, uint64_t length, uint64_t bytesPerChunk, uint32_t& firstChunk);
+
+  static constexpr uint64_t k_MaxRunBytes = 8 * 1024 * 1024;
+  static constexpr uint32_t k_MaxGapChunks = 8;
+
+  std::string m_FilePath;
+  intptr_t m_OutputHandle = -1;
+
+  uint32_t m_ChunkSize = k_DefaultChunkSize;
+  double m_Fragmentation = 0.0;
+  uint64_t m_Seed = 1;
+  float m_Version = 2.6f;
+  std::mt19937_64 m_Random;
+
+  uint32_t m_NextChunk = 1;
+  std::vector<uint32_t> m_FreeChunks;
+
+  std::vector<TreeItem> m_TreeItems;
+  std::map<std::string, int32_t> m_Directories;
+
+  int32_t m_CurrentItem = -1;
+  std::vector<uint32_t> m_CurrentChunks;
+  uint64_t m_ChunkFill = 0;
+
+  uint32_t m_CompressedBlockSize = 0;
+  std::vector<uint8_t> m_Block;
+  std::vector<uint8_t> m_CompressedBlock;
+  uint32_t m_BlockCount = 0;
+
+  std::vector<uint8_t> m_Run;
+  uint32_t m_RunFirstChunk = 0;
+};
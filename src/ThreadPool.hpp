@@ -0,0 +1,167 @@
+/* ============================================================================
+ * Copyright (c) 2019 BlueQuartz Software, LLC
+ * All rights reserved.
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with any project and source this library is coupled.
+ * If not, see <https://www.gnu.org/licenses/#GPL>.
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+/**
+ * @brief The ThreadPool class is a small fixed size pool of worker threads that run queued tasks
+ * in the order they were queued.
+ */
+class ThreadPool
+{
+public:
+  /**
+   * @brief Starts 'threadCount' worker threads. At least one worker is always started.
+   * @param threadCount
+   */
+  explicit ThreadPool(size_t threadCount)
+  {
+    threadCount = std::max<size_t>(threadCount, 1);
+    m_Workers.reserve(threadCount);
+    for(size_t i = 0; i < threadCount; i++)
+    {
+      m_Workers.emplace_back([this]() { workerLoop(); });
+    }
+  }
+
+  /**
+   * @brief Finishes all queued tasks and then joins the worker threads
+   */
+  ~ThreadPool()
+  {
+    {
+      std::lock_guard<std::mutex> lock(m_Mutex);
+      m_Stopping = true;
+    }
+    m_TaskAvailable.notify_all();
+    for(auto& worker : m_Workers)
+    {
+      worker.join();
+    }
+  }
+
+  ThreadPool(const ThreadPool&) = delete;            // Copy Constructor Not Implemented
+  ThreadPool(ThreadPool&&) = delete;                 // Move Constructor Not Implemented
+  ThreadPool& operator=(const ThreadPool&) = delete; // Copy Assignment Not Implemented
+  ThreadPool& operator=(ThreadPool&&) = delete;      // Move Assignment Not Implemented
+
+  /**
+   * @brief DefaultThreadCount Returns the number of hardware threads, or 1 if that is unknown
+   * @return
+   */
+  static size_t DefaultThreadCount()
+  {
+    return std::max<size_t>(std::thread::hardware_concurrency(), 1);
+  }
+
+  /**
+   * @brief getThreadCount
+   * @return
+   */
+  size_t getThreadCount() const
+  {
+    return m_Workers.size();
+  }
+
+  /**
+   * @brief enqueue Queues a task to be run on the next free worker
+   * @param task
+   */
+  void enqueue(std::function<void()> task)
+  {
+    {
+      std::lock_guard<std::mutex> lock(m_Mutex);
+      m_Tasks.push_back(std::move(task));
+    }
+    m_TaskAvailable.notify_one();
+  }
+
+  /**
+   * @brief submit Queues a task like enqueue() and returns a future for its result
+   * @param function
+   * @return
+   */
+  template <typename Function>
+  std::future<std::invoke_result_t<std::decay_t<Function>>> submit(Function&& function)
+  {
+    using Result = std::invoke_result_t<std::decay_t<Function>>;
+    // std::function needs a copyable target, so the task is shared with the queued wrapper
+    auto task = std::make_shared<std::packaged_task<Result()>>(std::forward<Function>(function));
+    std::future<Result> result = task->get_future();
+    enqueue([task]() { (*task)(); });
+    return result;
+  }
+
+  /**
+   * @brief waitForAll Blocks until every queued task has finished running
+   */
+  void waitForAll()
+  {
+    std::unique_lock<std::mutex> lock(m_Mutex);
+    m_AllDone.wait(lock, [this]() { return m_Tasks.empty() && m_ActiveTasks == 0; });
+  }
+
+private:
+  void workerLoop()
+  {
+    while(true)
+    {
+      std::function<void()> task;
+      {
+        std::unique_lock<std::mutex> lock(m_Mutex);
+        m_TaskAvailable.wait(lock, [this]() { return m_Stopping || !m_Tasks.empty(); });
+        if(m_Tasks.empty())
+        {
+          return;
+        }
+        task = std::move(m_Tasks.front());
+        m_Tasks.pop_front();
+        m_ActiveTasks++;
+      }
+      task();
+      {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        m_ActiveTasks--;
+        if(m_Tasks.empty() && m_ActiveTasks == 0)
+        {
+          m_AllDone.notify_all();
+        }
+      }
+    }
+  }
+
+  std::vector<std::thread> m_Workers;
+  std::deque<std::function<void()>> m_Tasks;
+  std::mutex m_Mutex;
+  std::condition_variable m_TaskAvailable;
+  std::condition_variable m_AllDone;
+  size_t m_ActiveTasks = 0;
+  bool m_Stopping = false;
+};
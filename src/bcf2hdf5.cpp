@@ -1,10 +1,32 @@
 #include "BcfHdf5Convertor.h"
 
+#include <charconv>
 #include <iostream>
 #include <string>
 #include <sstream>
 #include <vector>
 
+namespace
+{
+// -----------------------------------------------------------------------------
+/**
+ * @brief Parses a whole string of decimal digits. Signs, spaces and trailing characters are rejected.
+ */
+bool parseCount(const std::string& text, uint64_t& value)
+{
+  const char* end = text.data() + text.size();
+  auto result = std::from_chars(text.data(), end, value);
+  return !text.empty() && result.ec == std::errc() && result.ptr == end;
+}
+
+// -----------------------------------------------------------------------------
+int invalidValue(const std::string& option, const std::string& value)
+{
+  std::cout << "Invalid value '" << value << "' for " << option << ". Use --help for more information." << std::endl;
+  return EXIT_FAILURE;
+}
+} // namespace
+
 int main(int argc, char* argv[])
 {
   std::string version("1.0.0");
@@ -13,6 +35,13 @@ int main(int argc, char* argv[])
   const size_t k_FlipPatter = 2;
   const size_t k_Reorder = 3;
   const size_t k_HelpIndex = 4;
+  const size_t k_MemoryMap = 5;
+  const size_t k_IndexCache = 6;
+  const size_t k_DirectIO = 7;
+  const size_t k_Prefetch = 8;
+  const size_t k_SortReads = 9;
+  const size_t k_Chunking = 10;
+  const size_t k_Compression = 11;
 
   using ArgEntry = std::vector<std::string>;
   using ArgEntries = std::vector<ArgEntry>;
@@ -24,11 +53,25 @@ int main(int argc, char* argv[])
   args.push_back({"-r", "--reorder", "Reorder Data inside of HDF5 file. This can increase final file size significantly. true or false."});
   args.push_back({"-f", "--flip", "Flip the patterns across the X Axis (Vertical Flip). true or false."});
   args.push_back({"-h", "--help", "Show help for this program"});
+  args.push_back({"-m", "--mmap", "Memory map the input file instead of reading the pattern data through file reads. true or false. (Optional)"});
+  args.push_back({"-i", "--index", "Reuse or write a '.bcfidx' index next to the input file so it opens without walking the container. true or false. (Optional)"});
+  args.push_back({"-d", "--direct", "Read the input with direct I/O and drop the output from the page cache as it is written, so large conversions do not evict other data from memory. Implies -s. true or false. (Optional)"});
+  args.push_back({"-p", "--prefetch", "Number of MB of the pattern data to read ahead in the background. 0 turns the read-ahead off. The default is 32. (Optional)"});
+  args.push_back({"-s", "--sorted", "Read the patterns in the order they are stored in the input file instead of in scan order. Faster on spinning disks and network storage. true or false. (Optional)"});
+  args.push_back({"-c", "--chunk", "HDF5 chunk layout of the patterns: 'row' (the default) for one chunk per map row, a number of patterns per chunk, '<N>MB' for as many patterns as fit in N MB, below 4096 MB, or 'auto' for 2 MB. (Optional)"});
+  args.push_back({"-z", "--compress", "Compress the patterns with shuffle and deflate at the given level, 1 to 9. The chunks are compressed on all cores. 0 turns compression off, the default. (Optional)"});
 
   std::string inputFile;
   std::string outputFile;
   std::string reorder;
   std::string flipPatterns;
+  std::string memoryMap;
+  std::string indexCache;
+  std::string directIO;
+  std::string prefetch;
+  std::string sortReads;
+  std::string chunking;
+  std::string compression;
   bool header = false;
 
   for(int32_t i = 0; i < argc; i++)
@@ -49,6 +92,34 @@ int main(int argc, char* argv[])
     {
       reorder = argv[++i];
     }
+    if(argv[i] == args[k_MemoryMap][0] || argv[i] == args[k_MemoryMap][1])
+    {
+      memoryMap = argv[++i];
+    }
+    if(argv[i] == args[k_IndexCache][0] || argv[i] == args[k_IndexCache][1])
+    {
+      indexCache = argv[++i];
+    }
+    if(argv[i] == args[k_DirectIO][0] || argv[i] == args[k_DirectIO][1])
+    {
+      directIO = argv[++i];
+    }
+    if(argv[i] == args[k_Prefetch][0] || argv[i] == args[k_Prefetch][1])
+    {
+      prefetch = argv[++i];
+    }
+    if(argv[i] == args[k_SortReads][0] || argv[i] == args[k_SortReads][1])
+    {
+      sortReads = argv[++i];
+    }
+    if(argv[i] == args[k_Chunking][0] || argv[i] == args[k_Chunking][1])
+    {
+      chunking = argv[++i];
+    }
+    if(argv[i] == args[k_Compression][0] || argv[i] == args[k_Compression][1])
+    {
+      compression = argv[++i];
+    }
 
     if(argv[i] == args[k_HelpIndex][0] || argv[i] == args[k_HelpIndex][1])
     {
@@ -62,16 +133,62 @@ int main(int argc, char* argv[])
   }
 
 
-  if(argc != 9)
+  if(argc < 9 || argc > 23 || argc % 2 == 0)
   {
     std::cout << "7 Arguments are required. Use --help for more information." << std::endl;
     return EXIT_FAILURE;
   }
 
 
+  // Check the numeric options before any work is done
+  uint64_t prefetchMB = 0;
+  if(!prefetch.empty() && !parseCount(prefetch, prefetchMB))
+  {
+    return invalidValue(args[k_Prefetch][0], prefetch);
+  }
+  BcfHdf5Convertor::PatternChunking patternChunking = BcfHdf5Convertor::PatternChunking::Row;
+  uint64_t chunkValue = 0;
+  if(chunking == "auto")
+  {
+    patternChunking = BcfHdf5Convertor::PatternChunking::Bytes;
+    chunkValue = BcfHdf5Convertor::k_DefaultChunkBytes;
+  }
+  else if(chunking.size() > 2 && chunking.substr(chunking.size() - 2) == "MB")
+  {
+    if(!parseCount(chunking.substr(0, chunking.size() - 2), chunkValue) || chunkValue == 0 || chunkValue > BcfHdf5Convertor::k_MaxChunkBytes / (1024 * 1024))
+    {
+      return invalidValue(args[k_Chunking][0], chunking);
+    }
+    patternChunking = BcfHdf5Convertor::PatternChunking::Bytes;
+    chunkValue *= 1024 * 1024;
+  }
+  else if(!chunking.empty() && chunking != "row")
+  {
+    if(!parseCount(chunking, chunkValue) || chunkValue == 0)
+    {
+      return invalidValue(args[k_Chunking][0], chunking);
+    }
+    patternChunking = BcfHdf5Convertor::PatternChunking::Patterns;
+  }
+  uint64_t compressionLevel = 0;
+  if(!compression.empty() && (!parseCount(compression, compressionLevel) || compressionLevel > 9))
+  {
+    return invalidValue(args[k_Compression][0], compression);
+  }
+
   BcfHdf5Convertor convertor(inputFile, outputFile);
   convertor.setReorder(reorder == "true");
   convertor.setFlipPatterns(flipPatterns == "true");
+  convertor.setSortPatternReads(sortReads == "true");
+  convertor.setUseMemoryMap(memoryMap == "true");
+  convertor.setUseIndexCache(indexCache == "true");
+  convertor.setUseDirectIO(directIO == "true");
+  if(!prefetch.empty())
+  {
+    convertor.setPrefetchWindow(prefetchMB * 1024 * 1024);
+  }
+  convertor.setPatternChunking(patternChunking, chunkValue);
+  convertor.setCompressionLevel(static_cast<int32_t>(compressionLevel));
   convertor.execute();
   int32_t err = convertor.getErrorCode();
   if(err < 0)
@@ -0,0 +1,475 @@
+/* ============================================================================
+ * Copyright (c) 2019 BlueQuartz Software, LLC
+ * All rights reserved.
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with any project and source this library is coupled.
+ * If not, see <https://www.gnu.org/licenses/#GPL>.
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "Base64.hpp"
+#include "BrukerIntegration/BrukerIntegrationConstants.h"
+#include "BrukerIntegration/BrukerIntegrationStructs.h"
+#include "SFSWriter.h"
+
+namespace
+{
+struct GeneratorSettings
+{
+  int32_t mapWidth = 64;
+  int32_t mapHeight = 48;
+  int32_t patternWidth = 160;
+  int32_t patternHeight = 120;
+  int32_t bytesPerPixel = 1;
+  double unmeasured = 0.0;
+  uint64_t seed = 1;
+};
+
+// -----------------------------------------------------------------------------
+std::string memberPath(const std::string& fileName)
+{
+  return Bruker::Files::EBSDData + "/" + fileName;
+}
+
+// -----------------------------------------------------------------------------
+int32_t addTextFile(SFSWriter& writer, const std::string& fileName, const std::string& contents)
+{
+  return writer.addFile(memberPath(fileName), contents.data(), contents.size());
+}
+
+// -----------------------------------------------------------------------------
+/**
+ * @brief The scan dimensions that BrukerDataLoader::ReadScanSizes() looks for
+ */
+std::string makeAuxiliarien(const GeneratorSettings& settings)
+{
+  std::stringstream out;
+  out << "AcquisitionStep=1\n";
+  out << "SEMImgWidth=" << settings.mapWidth << "\n";
+  out << "SEMImgHeight=" << settings.mapHeight << "\n";
+  out << "MapWidth=" << settings.mapWidth << "\n";
+  out << "MapHeight=" << settings.mapHeight << "\n";
+  out << "EBSPWidth=" << settings.patternWidth << "\n";
+  out << "EBSPHeight=" << settings.patternHeight << "\n";
+  out << "ChannelNameCount=1\n";
+  out << "ChannelName0=SE\n";
+  out << "MeasurementDuration=-1\n";
+  out << "MaxRadonBandCount=12\n";
+  return out.str();
+}
+
+// -----------------------------------------------------------------------------
+std::string makePhaseList()
+{
+  std::stringstream out;
+  out << "<?xml version=\"1.0\" encoding=\"WINDOWS-1252\" standalone=\"yes\"?>\n";
+  out << "<TEBSDExtPhaseEntryList Type=\"TEBSDExtPhaseEntryList\">";
+  out << "<ClassInstance Type=\"TEBSDExtPhaseEntryList\" Name=\"Phase List\">";
+  out << "<ChildClassInstances>";
+  out << "<ClassInstance Type=\"TEBSDExtPhaseEntry\" Name=\"Iron bcc\">";
+  out << "<TEBSDPhaseEntry>";
+  out << "<Chem>Fe</Chem>";
+  out << "<Cell><Dim>2.8665,2.8665,2.8665</Dim><Angles>90,90,90</Angles></Cell>";
+  out << "<SE>1</SE><SG>Im-3m</SG><IT>229</IT><AT>1</AT><POS0>Fe,0,0,0,1,0.0035,Def</POS0>";
+  out << "</TEBSDPhaseEntry>";
+  out << "</ClassInstance>";
+  out << "</ChildClassInstances>";
+  out << "</ClassInstance>";
+  out << "</TEBSDExtPhaseEntryList>\n";
+  return out.str();
+}
+
+// -----------------------------------------------------------------------------
+/**
+ * @brief An 8 bit gradient with the size of the map as the SEM image
+ */
+std::string makeSEMImage(const GeneratorSettings& settings)
+{
+  std::string image(static_cast<size_t>(settings.mapWidth) * settings.mapHeight, '\0');
+  for(int32_t y = 0; y < settings.mapHeight; y++)
+  {
+    for(int32_t x = 0; x < settings.mapWidth; x++)
+    {
+      image[static_cast<size_t>(y) * settings.mapWidth + x] = static_cast<char>((x + y) & 0xFF);
+    }
+  }
+
+  std::stringstream out;
+  out << "<?xml version=\"1.0\" encoding=\"WINDOWS-1252\" standalone=\"yes\"?>\n";
+  out << "<TRTImageData Type=\"TRTImageData\">";
+  out << "<ClassInstance Type=\"TRTImageData\">";
+  out << "<Date>01.01.2020</Date><Time>12:00:00</Time>";
+  out << "<Width>" << settings.mapWidth << "</Width><Height>" << settings.mapHeight << "</Height>";
+  out << "<XCalibration>0.5</XCalibration><YCalibration>0.5</YCalibration>";
+  out << "<ItemSize>1</ItemSize><PlaneCount>1</PlaneCount>";
+  out << "<Plane0><Name>SE</Name><Description>Synthetic</Description><Data>" << macaron::Base64::Encode(image) << "</Data></Plane0>";
+  out << "<TRTHeaderedClass><ClassInstance Type=\"TRTREMHeader\"><Energy>20</Energy><Magnification>1000</Magnification></ClassInstance></TRTHeaderedClass>";
+  out << "</ClassInstance>";
+  out << "</TRTImageData>\n";
+  return out.str();
+}
+
+// -----------------------------------------------------------------------------
+std::string makeCalibration()
+{
+  std::stringstream out;
+  out << "<?xml version=\"1.0\" encoding=\"WINDOWS-1252\" standalone=\"yes\"?>\n";
+  out << "<TEBSDCalibration Type=\"TEBSDCalibration\">";
+  out << "<ClassInstance Type=\"TEBSDCalibration\">";
+  out << "<WorkingDistance>15</WorkingDistance><TopClip>0.1</TopClip><PCX>0.5</PCX><PCY>0.3</PCY><ProbeTilt>70</ProbeTilt>";
+  out << "</ClassInstance>";
+  out << "</TEBSDCalibration>\n";
+  return out.str();
+}
+
+// -----------------------------------------------------------------------------
+std::string makeAuxIndexingOptions()
+{
+  std::stringstream out;
+  out << "<?xml version=\"1.0\" encoding=\"WINDOWS-1252\" standalone=\"yes\"?>\n";
+  out << "<TEBSDAuxIndexingOptions Type=\"TEBSDAuxIndexingOptions\">";
+  out << "<ClassInstance Type=\"TEBSDAuxIndexingOptions\">";
+  out << "<MinIndexedBandCount>5</MinIndexedBandCount><MaxMAD>1.5</MaxMAD>";
+  out << "</ClassInstance>";
+  out << "</TEBSDAuxIndexingOptions>\n";
+  return out.str();
+}
+
+// -----------------------------------------------------------------------------
+std::string makeCameraConfiguration(const GeneratorSettings& settings)
+{
+  std::stringstream out;
+  out << "<?xml version=\"1.0\" encoding=\"WINDOWS-1252\" standalone=\"yes\"?>\n";
+  out << "<TCameraConfiguration Type=\"TCameraConfiguration\">";
+  out << "<ClassInstance Type=\"TCameraConfiguration\">";
+  out << "<PixelFormat>" << (settings.bytesPerPixel == 2 ? "Gray16" : "Gray8") << "</PixelFormat>";
+  out << "</ClassInstance>";
+  out << "</TCameraConfiguration>\n";
+  return out.str();
+}
+
+// -----------------------------------------------------------------------------
+/**
+ * @brief Writes the FrameDescription header followed by the FrameData offset of the pattern of every
+ * scan point, or all bits set for points that have no pattern
+ */
+int32_t writeFrameDescription(SFSWriter& writer, const GeneratorSettings& settings, const std::vector<uint8_t>& measured)
+{
+  int32_t err = writer.beginFile(memberPath(Bruker::Files::FrameDescription));
+  if(err < 0)
+  {
+    return err;
+  }
+  FrameDescriptionHeader_t header = {settings.mapWidth, settings.mapHeight, static_cast<int32_t>(measured.size())};
+  err = writer.write(&header, sizeof(header));
+
+  const uint64_t recordSize = sizeof(FrameDataHeader_t) + static_cast<uint64_t>(settings.patternWidth) * settings.patternHeight * settings.bytesPerPixel;
+  std::vector<uint64_t> offsets(measured.size());
+  uint64_t offset = 0;
+  for(size_t i = 0; i < measured.size(); i++)
+  {
+    offsets[i] = measured[i] != 0 ? offset : 0xFFFFFFFFFFFFFFFF;
+    offset += measured[i] != 0 ? recordSize : 0;
+  }
+  if(err == 0)
+  {
+    err = writer.write(offsets.data(), offsets.size() * sizeof(uint64_t));
+  }
+  if(err == 0)
+  {
+    err = writer.endFile();
+  }
+  return err;
+}
+
+// -----------------------------------------------------------------------------
+/**
+ * @brief Writes one version 6 indexing result record for every scan point
+ */
+int32_t writeIndexingResults(SFSWriter& writer, const GeneratorSettings& settings)
+{
+  int32_t err = writer.beginFile(memberPath(Bruker::Files::IndexingResults));
+  std::mt19937_64 random(settings.seed + 1);
+  std::uniform_real_distribution<float> angle(0.0f, 6.2831853f);
+  std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+  std::vector<IndexResult_t> row(settings.mapWidth);
+  for(int32_t y = 0; y < settings.mapHeight && err == 0; y++)
+  {
+    for(int32_t x = 0; x < settings.mapWidth; x++)
+    {
+      IndexResult_t& record = row[x];
+      record.xIndex = static_cast<uint16_t>(x);
+      record.yIndex = static_cast<uint16_t>(y);
+      record.radonQuality = unit(random);
+      record.detectedBands = static_cast<uint16_t>(8 + random() % 5);
+      record.euler1 = angle(random);
+      record.euler2 = angle(random) / 4.0f;
+      record.euler3 = angle(random);
+      record.phase = 1;
+      record.indexedBands = static_cast<uint16_t>(record.detectedBands - random() % 3);
+      record.bmm = unit(random) * 1.5f;
+    }
+    err = writer.write(row.data(), row.size() * sizeof(IndexResult_t));
+  }
+  if(err == 0)
+  {
+    err = writer.endFile();
+  }
+  return err;
+}
+
+// -----------------------------------------------------------------------------
+/**
+ * @brief Writes a pattern header and random pixels for every measured scan point, one map row at a time
+ */
+int32_t writeFrameData(SFSWriter& writer, const GeneratorSettings& settings, const std::vector<uint8_t>& measured)
+{
+  int32_t err = writer.beginFile(memberPath(Bruker::Files::FrameData));
+  const size_t patternBytes = static_cast<size_t>(settings.patternWidth) * settings.patternHeight * settings.bytesPerPixel;
+  const size_t recordSize = sizeof(FrameDataHeader_t) + patternBytes;
+  std::vector<uint8_t> row(recordSize * settings.mapWidth);
+  std::vector<uint64_t> pixels((patternBytes + sizeof(uint64_t) - 1) / sizeof(uint64_t));
+  std::mt19937_64 random(settings.seed + 2);
+
+  for(int32_t y = 0; y < settings.mapHeight && err == 0; y++)
+  {
+    std::cout << Bruker::Files::FrameData << " Writing Row " << y << "/" << settings.mapHeight << "\r";
+    std::cout.flush();
+    size_t rowBytes = 0;
+    for(int32_t x = 0; x < settings.mapWidth; x++)
+    {
+      if(measured[static_cast<size_t>(y) * settings.mapWidth + x] == 0)
+      {
+        continue;
+      }
+      FrameDataHeader_t header = {x, y, static_cast<int>(patternBytes + 17), settings.patternWidth, settings.patternHeight, settings.bytesPerPixel, 0};
+      ::memcpy(row.data() + rowBytes, &header, sizeof(header));
+      for(auto& value : pixels)
+      {
+        value = random();
+      }
+      ::memcpy(row.data() + rowBytes + sizeof(header), pixels.data(), patternBytes);
+      rowBytes += recordSize;
+    }
+    err = writer.write(row.data(), rowBytes);
+  }
+  std::cout << std::endl;
+  if(err == 0)
+  {
+    err = writer.endFile();
+  }
+  return err;
+}
+} // namespace
+
+// -----------------------------------------------------------------------------
+int main(int argc, char* argv[])
+{
+  const size_t k_OutputFileIndex = 0;
+  const size_t k_MapWidth = 1;
+  const size_t k_MapHeight = 2;
+  const size_t k_PatternWidth = 3;
+  const size_t k_PatternHeight = 4;
+  const size_t k_BytesPerPixel = 5;
+  const size_t k_ChunkSize = 6;
+  const size_t k_Fragmentation = 7;
+  const size_t k_Unmeasured = 8;
+  const size_t k_Seed = 9;
+  const size_t k_CompressedBlockSize = 10;
+  const size_t k_HelpIndex = 11;
+
+  using ArgEntry = std::vector<std::string>;
+  using ArgEntries = std::vector<ArgEntry>;
+
+  ArgEntries args;
+
+  args.push_back({"-o", "--output", "The .bcf file to write"});
+  args.push_back({"-x", "--map-width", "Number of scan points per row. (Optional, default 64)"});
+  args.push_back({"-y", "--map-height", "Number of scan rows. (Optional, default 48)"});
+  args.push_back({"-pw", "--pattern-width", "Pattern width in pixels. (Optional, default 160)"});
+  args.push_back({"-ph", "--pattern-height", "Pattern height in pixels. (Optional, default 120)"});
+  args.push_back({"-b", "--bytes-per-pixel", "1 (Gray8) or 2 (Gray16). (Optional, default 1)"});
+  args.push_back({"-c", "--chunk-size", "SFS chunk size in bytes. (Optional, default 4096)"});
+  args.push_back({"-f", "--fragmentation", "Fraction between 0 and 1 of chunks placed out of order. (Optional, default 0)"});
+  args.push_back({"-u", "--unmeasured", "Fraction between 0 and 1 of scan points without a pattern. (Optional, default 0)"});
+  args.push_back({"-s", "--seed", "Seed for the patterns, the indexing results and the chunk layout. (Optional, default 1)"});
+  args.push_back({"-z", "--compressed-block-size", "Store every file as zlib compressed blocks of this many bytes, 0 for uncompressed files. (Optional, default 0)"});
+  args.push_back({"-h", "--help", "Show help for this program"});
+
+  std::string outputFile;
+  GeneratorSettings settings;
+  uint32_t chunkSize = SFSWriter::k_DefaultChunkSize;
+  double fragmentation = 0.0;
+  uint32_t compressedBlockSize = 0;
+
+  for(int32_t i = 1; i < argc; i++)
+  {
+    std::string arg = argv[i];
+    if(arg == args[k_HelpIndex][0] || arg == args[k_HelpIndex][1])
+    {
+      std::cout << "This program writes a synthetic .bcf file with the following arguments:" << std::endl;
+      for(const auto& input : args)
+      {
+        std::cout << input[0] << ", " << input[1] << ": " << input[2] << std::endl;
+      }
+      return 0;
+    }
+    if(i + 1 >= argc)
+    {
+      std::cout << "Missing value for '" << arg << "'. Use --help for more information." << std::endl;
+      return EXIT_FAILURE;
+    }
+    std::string value = argv[++i];
+    if(arg == args[k_OutputFileIndex][0] || arg == args[k_OutputFileIndex][1])
+    {
+      outputFile = value;
+    }
+    else if(arg == args[k_MapWidth][0] || arg == args[k_MapWidth][1])
+    {
+      settings.mapWidth = std::atoi(value.c_str());
+    }
+    else if(arg == args[k_MapHeight][0] || arg == args[k_MapHeight][1])
+    {
+      settings.mapHeight = std::atoi(value.c_str());
+    }
+    else if(arg == args[k_PatternWidth][0] || arg == args[k_PatternWidth][1])
+    {
+      settings.patternWidth = std::atoi(value.c_str());
+    }
+    else if(arg == args[k_PatternHeight][0] || arg == args[k_PatternHeight][1])
+    {
+      settings.patternHeight = std::atoi(value.c_str());
+    }
+    else if(arg == args[k_BytesPerPixel][0] || arg == args[k_BytesPerPixel][1])
+    {
+      settings.bytesPerPixel = std::atoi(value.c_str());
+    }
+    else if(arg == args[k_ChunkSize][0] || arg == args[k_ChunkSize][1])
+    {
+      chunkSize = static_cast<uint32_t>(std::strtoul(value.c_str(), nullptr, 10));
+    }
+    else if(arg == args[k_Fragmentation][0] || arg == args[k_Fragmentation][1])
+    {
+      fragmentation = std::atof(value.c_str());
+    }
+    else if(arg == args[k_Unmeasured][0] || arg == args[k_Unmeasured][1])
+    {
+      settings.unmeasured = std::atof(value.c_str());
+    }
+    else if(arg == args[k_Seed][0] || arg == args[k_Seed][1])
+    {
+      settings.seed = std::strtoull(value.c_str(), nullptr, 10);
+    }
+    else if(arg == args[k_CompressedBlockSize][0] || arg == args[k_CompressedBlockSize][1])
+    {
+      compressedBlockSize = static_cast<uint32_t>(std::strtoul(value.c_str(), nullptr, 10));
+    }
+    else
+    {
+      std::cout << "Unknown argument '" << arg << "'. Use --help for more information." << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+
+  if(outputFile.empty())
+  {
+    std::cout << "An output file is required. Use --help for more information." << std::endl;
+    return EXIT_FAILURE;
+  }
+  // Scan indices are stored as 16 bit values in the indexing results
+  if(settings.mapWidth <= 0 || settings.mapHeight <= 0 || settings.mapWidth > 65535 || settings.mapHeight > 65535 || settings.patternWidth <= 0 ||
+     settings.patternHeight <= 0 || (settings.bytesPerPixel != 1 && settings.bytesPerPixel != 2) || chunkSize < SFSWriter::k_MinChunkSize)
+  {
+    std::cout << "Invalid map, pattern or chunk size. Use --help for more information." << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  // Decide up front which scan points have a pattern so FrameDescription can be written before FrameData
+  std::vector<uint8_t> measured(static_cast<size_t>(settings.mapWidth) * settings.mapHeight, 1);
+  std::mt19937_64 random(settings.seed);
+  std::uniform_real_distribution<double> unit(0.0, 1.0);
+  for(auto& point : measured)
+  {
+    point = unit(random) < settings.unmeasured ? 0 : 1;
+  }
+
+  const uint64_t patternBytes = static_cast<uint64_t>(settings.patternWidth) * settings.patternHeight * settings.bytesPerPixel;
+  std::cout << "Writing '" << outputFile << "' with about " << (measured.size() * (patternBytes + sizeof(FrameDataHeader_t))) / (1024 * 1024) << " MiB of pattern data" << std::endl;
+
+  SFSWriter writer;
+  writer.setChunkSize(chunkSize);
+  writer.setFragmentation(fragmentation);
+  writer.setSeed(settings.seed);
+  writer.setCompressedBlockSize(compressedBlockSize);
+  int32_t err = writer.open(outputFile);
+  if(err < 0)
+  {
+    return err;
+  }
+
+  err = addTextFile(writer, Bruker::Files::Auxiliarien, makeAuxiliarien(settings));
+  if(err == 0)
+  {
+    err = addTextFile(writer, Bruker::Files::PhaseList, makePhaseList());
+  }
+  if(err == 0)
+  {
+    err = addTextFile(writer, Bruker::Files::SEMImage, makeSEMImage(settings));
+  }
+  if(err == 0)
+  {
+    err = addTextFile(writer, Bruker::Files::Calibration, makeCalibration());
+  }
+  if(err == 0)
+  {
+    err = addTextFile(writer, Bruker::Files::AuxIndexingOptions, makeAuxIndexingOptions());
+  }
+  if(err == 0)
+  {
+    err = addTextFile(writer, Bruker::Files::CameraConfiguration, makeCameraConfiguration(settings));
+  }
+  if(err == 0)
+  {
+    err = writeFrameDescription(writer, settings, measured);
+  }
+  if(err == 0)
+  {
+    err = writeIndexingResults(writer, settings);
+  }
+  if(err == 0)
+  {
+    err = writeFrameData(writer, settings, measured);
+  }
+  int32_t closeErr = writer.close();
+  if(err == 0)
+  {
+    err = closeErr;
+  }
+  if(err < 0)
+  {
+    std::cout << "Error " << err << " writing '" << outputFile << "'" << std::endl;
+    return err;
+  }
+
+  std::cout << "Complete" << std::endl;
+  return 0;
+}
@@ -0,0 +1,309 @@
+/* ============================================================================
+ * Copyright (c) 2019 BlueQuartz Software, LLC
+ * All rights reserved.
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with any project and source this library is coupled.
+ * If not, see <https://www.gnu.org/licenses/#GPL>.
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "SFSNodeItem.h"
+#include "SFSReader.h"
+#include "SFSWriter.h"
+#include "StringUtilities.hpp"
+
+namespace
+{
+struct Member
+{
+  std::string path;
+  const SFSNodeItem* node = nullptr;
+};
+
+// -----------------------------------------------------------------------------
+/**
+ * @brief Collects every directory and file below 'node' in tree order
+ */
+void collectMembers(const SFSNodeItem& node, const std::string& path, std::vector<Member>& directories, std::vector<Member>& files)
+{
+  for(const SFSNodeItem* child : node.children())
+  {
+    std::string childPath = path.empty() ? child->getFileName() : path + "/" + child->getFileName();
+    if(child->isDirectory())
+    {
+      directories.push_back({childPath, child});
+      collectMembers(*child, childPath, directories, files);
+    }
+    else
+    {
+      files.push_back({childPath, child});
+    }
+  }
+}
+
+// -----------------------------------------------------------------------------
+/**
+ * @brief Splits a comma separated list of paths, dropping empty entries and surrounding slashes
+ */
+std::vector<std::string> splitPathList(const std::string& list)
+{
+  std::vector<std::string> paths;
+  for(std::string path : complex::StringUtilities::split_2(list, ','))
+  {
+    path = complex::StringUtilities::trimmed(path);
+    size_t first = path.find_first_not_of('/');
+    size_t last = path.find_last_not_of('/');
+    if(first != std::string::npos)
+    {
+      paths.push_back(path.substr(first, last - first + 1));
+    }
+  }
+  return paths;
+}
+
+// -----------------------------------------------------------------------------
+/**
+ * @brief Returns true if 'path' is 'entry' or lies inside the directory 'entry'
+ */
+bool matchesEntry(const std::string& path, const std::string& entry)
+{
+  return path == entry || (path.size() > entry.size() && path.compare(0, entry.size(), entry) == 0 && path[entry.size()] == '/');
+}
+
+// -----------------------------------------------------------------------------
+bool matchesAny(const std::string& path, const std::vector<std::string>& entries)
+{
+  return std::any_of(entries.begin(), entries.end(), [&path](const std::string& entry) { return matchesEntry(path, entry); });
+}
+
+// -----------------------------------------------------------------------------
+SFSWriter::ItemAttributes getAttributes(const SFSNodeItem& node)
+{
+  SFSWriter::ItemAttributes attributes;
+  attributes.creationTime = node.getFileCreationTime();
+  attributes.modificationTime = node.getFileModificationTime();
+  attributes.lastAccessTime = node.getFileLastAccessTime();
+  attributes.permissions = node.getPermissions();
+  return attributes;
+}
+
+// -----------------------------------------------------------------------------
+/**
+ * @brief Copies the stored bytes of a member into the next run of chunks of the output. Compressed
+ * members are copied as they are, without inflating them.
+ */
+int32_t copyMember(const Member& member, SFSWriter& writer, std::vector<uint8_t>& buffer)
+{
+  const SFSNodeItem& node = *member.node;
+  if(!node.getIsValid())
+  {
+    std::cout << "The pointer table of '" << member.path << "' could not be read" << std::endl;
+    return -10;
+  }
+  int32_t err = writer.beginFile(member.path, getAttributes(node));
+  const uint64_t fileSize = node.getFileSize();
+  uint64_t offset = 0;
+  while(err == 0 && offset < fileSize)
+  {
+    const uint64_t count = std::min<uint64_t>(buffer.size(), fileSize - offset);
+    if(node.readStoredData(offset, count, buffer.data()) != static_cast<int64_t>(count))
+    {
+      std::cout << "Error reading '" << member.path << "'" << std::endl;
+      return -11;
+    }
+    err = writer.write(buffer.data(), count);
+    offset += count;
+  }
+  if(err == 0)
+  {
+    err = writer.endFile();
+  }
+  return err;
+}
+} // namespace
+
+// -----------------------------------------------------------------------------
+int main(int argc, char* argv[])
+{
+  const size_t k_InputFileIndex = 0;
+  const size_t k_OutputFileIndex = 1;
+  const size_t k_Order = 2;
+  const size_t k_Drop = 3;
+  const size_t k_ChunkSize = 4;
+  const size_t k_HelpIndex = 5;
+
+  using ArgEntry = std::vector<std::string>;
+  using ArgEntries = std::vector<ArgEntry>;
+
+  ArgEntries args;
+
+  args.push_back({"-i", "--input", "The .bcf file to repack"});
+  args.push_back({"-o", "--output", "The repacked .bcf file to write"});
+  args.push_back({"-m", "--order", "Comma separated members or directories to write first, in this order, for example EBSDData/FrameDescription,EBSDData/FrameData. (Optional)"});
+  args.push_back({"-d", "--drop", "Comma separated members or directories to leave out. (Optional)"});
+  args.push_back({"-c", "--chunk-size", "SFS chunk size of the output in bytes. (Optional, default is the chunk size of the input)"});
+  args.push_back({"-h", "--help", "Show help for this program"});
+
+  std::string inputFile;
+  std::string outputFile;
+  std::vector<std::string> order;
+  std::vector<std::string> drop;
+  uint32_t chunkSize = 0;
+
+  for(int32_t i = 1; i < argc; i++)
+  {
+    std::string arg = argv[i];
+    if(arg == args[k_HelpIndex][0] || arg == args[k_HelpIndex][1])
+    {
+      std::cout << "This program rewrites a .bcf file with the chunks of every member stored back to back:" << std::endl;
+      for(const auto& input : args)
+      {
+        std::cout << input[0] << ", " << input[1] << ": " << input[2] << std::endl;
+      }
+      return 0;
+    }
+    if(i + 1 >= argc)
+    {
+      std::cout << "Missing value for '" << arg << "'. Use --help for more information." << std::endl;
+      return EXIT_FAILURE;
+    }
+    std::string value = argv[++i];
+    if(arg == args[k_InputFileIndex][0] || arg == args[k_InputFileIndex][1])
+    {
+      inputFile = value;
+    }
+    else if(arg == args[k_OutputFileIndex][0] || arg == args[k_OutputFileIndex][1])
+    {
+      outputFile = value;
+    }
+    else if(arg == args[k_Order][0] || arg == args[k_Order][1])
+    {
+      order = splitPathList(value);
+    }
+    else if(arg == args[k_Drop][0] || arg == args[k_Drop][1])
+    {
+      drop = splitPathList(value);
+    }
+    else if(arg == args[k_ChunkSize][0] || arg == args[k_ChunkSize][1])
+    {
+      chunkSize = static_cast<uint32_t>(std::strtoul(value.c_str(), nullptr, 10));
+    }
+    else
+    {
+      std::cout << "Unknown argument '" << arg << "'. Use --help for more information." << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+
+  if(inputFile.empty() || outputFile.empty())
+  {
+    std::cout << "An input and an output file are required. Use --help for more information." << std::endl;
+    return EXIT_FAILURE;
+  }
+  if(inputFile == outputFile)
+  {
+    std::cout << "The output file must not be the input file." << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  SFSReader sfsFile;
+  int32_t err = sfsFile.parseFile(inputFile);
+  if(err < 0)
+  {
+    std::cout << "Error " << err << " reading '" << inputFile << "'" << std::endl;
+    return err;
+  }
+
+  std::vector<Member> directories;
+  std::vector<Member> files;
+  collectMembers(*sfsFile.getRootNode(), "", directories, files);
+
+  // The requested members go first, in the order they were listed. Everything else follows in tree order.
+  std::vector<Member> orderedFiles;
+  std::vector<uint8_t> taken(files.size(), 0);
+  for(const auto& entry : order)
+  {
+    for(size_t i = 0; i < files.size(); i++)
+    {
+      if(taken[i] == 0 && matchesEntry(files[i].path, entry))
+      {
+        orderedFiles.push_back(files[i]);
+        taken[i] = 1;
+      }
+    }
+  }
+  for(size_t i = 0; i < files.size(); i++)
+  {
+    if(taken[i] == 0)
+    {
+      orderedFiles.push_back(files[i]);
+    }
+  }
+
+  SFSWriter writer;
+  writer.setChunkSize(chunkSize != 0 ? chunkSize : sfsFile.getChunkSize());
+  writer.setVersion(sfsFile.getVersion());
+  err = writer.open(outputFile);
+  if(err < 0)
+  {
+    return err;
+  }
+
+  for(const auto& directory : directories)
+  {
+    if(!matchesAny(directory.path, drop))
+    {
+      err = writer.addDirectory(directory.path, getAttributes(*directory.node));
+    }
+    if(err < 0)
+    {
+      break;
+    }
+  }
+
+  std::vector<uint8_t> buffer(32 * 1024 * 1024);
+  for(const auto& file : orderedFiles)
+  {
+    if(err < 0)
+    {
+      break;
+    }
+    if(matchesAny(file.path, drop))
+    {
+      std::cout << "Dropping File: " << file.path << std::endl;
+      continue;
+    }
+    std::cout << "Copying File: " << file.path << std::endl;
+    err = copyMember(file, writer, buffer);
+  }
+
+  int32_t closeErr = writer.close();
+  if(err == 0)
+  {
+    err = closeErr;
+  }
+  if(err < 0)
+  {
+    std::cout << "Error " << err << " writing '" << outputFile << "'" << std::endl;
+    return err;
+  }
+
+  std::cout << "Complete" << std::endl;
+  return 0;
+}
@@ -16,35 +16,75 @@
  * along with any project and source this library is coupled.
  * If not, see <https://www.gnu.org/licenses/#GPL>.
  * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+#include <cstdlib>
 #include <iostream>
 
 #include "SFSReader.h"
 #include "SFSNodeItem.h"
+#include "ThreadPool.hpp"
 
 
 
 /**
- * @brief This will upack all the files within an SFS file archive. This will NOT support
- * SFS files that have compression or encryption enabled.
+ * @brief This will upack all the files within an SFS file archive. Files in zlib compressed
+ * archives are inflated on the way out. Encrypted archives are NOT supported. An optional third argument sets the
+ * number of files that are written at the same time. Use 0 for one per hardware thread. A trailing '--direct'
+ * reads the archive with direct I/O and drops the extracted files from the page cache as they are written. A
+ * trailing '--sweep' reads the archive once from front to back and writes every chunk into the file it belongs to.
+ * A trailing '--copy-range' lets the kernel copy archives with large chunks using copy_file_range().
  * @param argc
  * @param argv
  * @return
  */
 int main(int argc, char const *argv[])
 {
-  if(argc != 3)
+  bool directIO = false;
+  bool sweep = false;
+  bool copyRange = false;
+  while(argc > 3)
+  {
+    std::string flag(argv[argc - 1]);
+    if(flag == "--direct")
+    {
+      directIO = true;
+    }
+    else if(flag == "--sweep")
+    {
+      sweep = true;
+    }
+    else if(flag == "--copy-range")
+    {
+      copyRange = true;
+    }
+    else
+    {
+      break;
+    }
+    argc--;
+  }
+  if(argc != 3 && argc != 4)
   {
     std::cout << "Need the input file name and output directory" << std::endl;
+    std::cout << "Usage: unbcf <input.bcf> <output directory> [thread count] [--direct] [--sweep] [--copy-range]" << std::endl;
     return 1;
   }
   std::string inputFile(argv[1]);
   std::string outputDir(argv[2]);
+  size_t threadCount = 1;
+  if(argc == 4)
+  {
+    int value = std::atoi(argv[3]);
+    threadCount = value > 0 ? static_cast<size_t>(value) : ThreadPool::DefaultThreadCount();
+  }
   if(outputDir.back() != '/')
   {
     outputDir = outputDir + '/';
   }
 
   SFSReader sfsFile;
+  sfsFile.setUseDirectIO(directIO);
+  sfsFile.setUseSweepExtraction(sweep);
+  sfsFile.setUseCopyFileRange(copyRange);
   sfsFile.parseFile(inputFile);
 
  
@@ -61,7 +101,7 @@ int main(int argc, char const *argv[])
   std::string outputPath = outputDir + baseName;
   //sfsFile.extractFile(outputPath, "EBSDData/SEMImage");
   std::cout << "Extracting to " << outputPath << std::endl;
-  sfsFile.extractAll(outputPath);
+  sfsFile.extractAll(outputPath, threadCount);
 
   std::cout << "Complete" << std::endl;
 